@@ -23,24 +23,39 @@
  */
 
 #include "gimo-archive.h"
-#include "gimo-utils.h"
+#include "gimo-error.h"
+#include "gimo-marshal.h"
 
 G_DEFINE_TYPE (GimoArchive, gimo_archive, G_TYPE_OBJECT)
 
+enum {
+    SIG_OBJECTPARSED,
+    LAST_SIGNAL
+};
+
+/*
+ * The objects are kept in insertion order, the named ones are also
+ * indexed by identifier.
+ */
+struct _ArchiveEntry {
+    gchar *id;
+    GObject *object;
+};
+
 struct _GimoArchivePrivate {
-    GTree *objects;
+    GHashTable *index;
+    GPtrArray *entries;
+    GimoArchive *shared;
     GMutex mutex;
 };
 
-static gboolean _gimo_archive_query_objects (gpointer key,
-                                             gpointer value,
-                                             gpointer data)
+static void _archive_entry_free (gpointer p)
 {
-    GPtrArray *param = data;
+    struct _ArchiveEntry *entry = p;
 
-    g_ptr_array_add (param, g_object_ref (value));
-
-    return FALSE;
+    g_free (entry->id);
+    g_object_unref (entry->object);
+    g_free (entry);
 }
 
 static void gimo_archive_init (GimoArchive *self)
@@ -52,17 +67,25 @@ static void gimo_archive_init (GimoArchive *self)
                                               GimoArchivePrivate);
     priv = self->priv;
 
-    priv->objects = g_tree_new_full (_gimo_gtree_string_compare,
-                                     NULL, g_free, g_object_unref);
+    priv->index = g_hash_table_new (g_str_hash, g_str_equal);
+    priv->entries = g_ptr_array_new_with_free_func (_archive_entry_free);
+    priv->shared = NULL;
     g_mutex_init (&priv->mutex);
 }
 
+static guint archive_signals[LAST_SIGNAL] = { 0 };
+
 static void gimo_archive_finalize (GObject *gobject)
 {
     GimoArchive *self = GIMO_ARCHIVE (gobject);
     GimoArchivePrivate *priv = self->priv;
 
-    g_tree_unref (priv->objects);
+    g_hash_table_unref (priv->index);
+    g_ptr_array_unref (priv->entries);
+
+    if (priv->shared)
+        g_object_unref (priv->shared);
+
     g_mutex_clear (&priv->mutex);
 
     G_OBJECT_CLASS (gimo_archive_parent_class)->finalize (gobject);
@@ -76,9 +99,32 @@ static void gimo_archive_class_init (GimoArchiveClass *klass)
 
     klass->read = NULL;
     klass->save = NULL;
+    klass->read_data = NULL;
+    klass->object_parsed = NULL;
 
     g_type_class_add_private (gobject_class,
                               sizeof (GimoArchivePrivate));
+
+    /**
+     * GimoArchive::object-parsed:
+     * @self: the archive
+     * @id: (allow-none): the object identifier
+     * @object: the top level object
+     *
+     * Emitted as soon as a top level object is read, return %TRUE
+     * to take the object, it won't be kept by the archive.
+     */
+    archive_signals[SIG_OBJECTPARSED] =
+            g_signal_new ("object-parsed",
+                          G_OBJECT_CLASS_TYPE (gobject_class),
+                          G_SIGNAL_RUN_LAST,
+                          G_STRUCT_OFFSET (GimoArchiveClass, object_parsed),
+                          g_signal_accumulator_true_handled, NULL,
+                          _gimo_marshal_BOOLEAN__STRING_OBJECT,
+                          G_TYPE_BOOLEAN,
+                          2,
+                          G_TYPE_STRING,
+                          G_TYPE_OBJECT);
 }
 
 GimoArchive* gimo_archive_new (void)
@@ -94,6 +140,54 @@ gboolean gimo_archive_read (GimoArchive *self,
     return GIMO_ARCHIVE_GET_CLASS (self)->read (self, file_name);
 }
 
+/**
+ * gimo_archive_read_data:
+ * @self: a #GimoArchive
+ * @data: (array length=length): the archive content
+ * @length: the length of @data
+ *
+ * Read the archive from a memory buffer, no file is touched.
+ *
+ * Returns: whether the archive is read
+ */
+gboolean gimo_archive_read_data (GimoArchive *self,
+                                 const gchar *data,
+                                 gsize length)
+{
+    GimoArchiveClass *klass;
+
+    g_return_val_if_fail (GIMO_IS_ARCHIVE (self), FALSE);
+
+    klass = GIMO_ARCHIVE_GET_CLASS (self);
+    if (NULL == klass->read_data)
+        gimo_set_error_return_val (GIMO_ERROR_INVALID_OBJECT, FALSE);
+
+    return klass->read_data (self, data, length);
+}
+
+/**
+ * gimo_archive_read_bytes:
+ * @self: a #GimoArchive
+ * @bytes: the archive content
+ *
+ * Read the archive from a #GBytes, e.g. a resource embedded in
+ * the application.
+ *
+ * Returns: whether the archive is read
+ */
+gboolean gimo_archive_read_bytes (GimoArchive *self,
+                                  GBytes *bytes)
+{
+    gconstpointer data;
+    gsize length;
+
+    g_return_val_if_fail (bytes != NULL, FALSE);
+
+    data = g_bytes_get_data (bytes, &length);
+
+    return gimo_archive_read_data (self, data, length);
+}
+
 gboolean gimo_archive_save (GimoArchive *self,
                             const gchar *file_name)
 {
@@ -107,7 +201,7 @@ gboolean gimo_archive_add_object (GimoArchive *self,
                                   GObject *object)
 {
     GimoArchivePrivate *priv;
-    gchar *real_id;
+    struct _ArchiveEntry *entry;
 
     g_return_val_if_fail (GIMO_IS_ARCHIVE (self), FALSE);
 
@@ -115,19 +209,19 @@ gboolean gimo_archive_add_object (GimoArchive *self,
 
     g_mutex_lock (&priv->mutex);
 
-    if (id && g_tree_lookup (priv->objects, id)) {
+    if (id && g_hash_table_lookup (priv->index, id)) {
         g_mutex_unlock (&priv->mutex);
         return FALSE;
     }
 
+    entry = g_malloc (sizeof *entry);
+    entry->id = g_strdup (id);
+    entry->object = g_object_ref (object);
+
     if (id)
-        real_id = g_strdup (id);
-    else
-        real_id = g_strdup_printf ("<%d>", g_tree_nnodes (priv->objects));
+        g_hash_table_insert (priv->index, entry->id, entry);
 
-    g_tree_insert (priv->objects,
-                   real_id,
-                   g_object_ref (object));
+    g_ptr_array_add (priv->entries, entry);
 
     g_mutex_unlock (&priv->mutex);
 
@@ -138,14 +232,22 @@ void gimo_archive_remove_object (GimoArchive *self,
                                  const gchar *id)
 {
     GimoArchivePrivate *priv;
+    struct _ArchiveEntry *entry;
 
     g_return_if_fail (GIMO_IS_ARCHIVE (self));
 
+    if (NULL == id)
+        return;
+
     priv = self->priv;
 
     g_mutex_lock (&priv->mutex);
 
-    g_tree_remove (priv->objects, id);
+    entry = g_hash_table_lookup (priv->index, id);
+    if (entry) {
+        g_hash_table_remove (priv->index, id);
+        g_ptr_array_remove (priv->entries, entry);
+    }
 
     g_mutex_unlock (&priv->mutex);
 }
@@ -163,18 +265,19 @@ GObject* gimo_archive_query_object (GimoArchive *self,
                                     const gchar *id)
 {
     GimoArchivePrivate *priv;
-    GObject *object;
+    struct _ArchiveEntry *entry;
+    GObject *object = NULL;
 
     g_return_val_if_fail (GIMO_IS_ARCHIVE (self), NULL);
+    g_return_val_if_fail (id != NULL, NULL);
 
     priv = self->priv;
 
     g_mutex_lock (&priv->mutex);
 
-    object = g_tree_lookup (priv->objects, id);
-
-    if (object)
-        g_object_ref (object);
+    entry = g_hash_table_lookup (priv->index, id);
+    if (entry)
+        object = g_object_ref (entry->object);
 
     g_mutex_unlock (&priv->mutex);
 
@@ -185,7 +288,7 @@ GObject* gimo_archive_query_object (GimoArchive *self,
  * gimo_archive_query_objects:
  * @self: a #GimoArchive
  *
- * Query all the objects in the archive.
+ * Query all the objects in the archive, in the order they are added.
  *
  * Returns: (element-type GObject.Object) (transfer container):
  *          an array of objects.
@@ -194,6 +297,8 @@ GPtrArray* gimo_archive_query_objects (GimoArchive *self)
 {
     GimoArchivePrivate *priv;
     GPtrArray *param = NULL;
+    struct _ArchiveEntry *entry;
+    guint i;
 
     g_return_val_if_fail (GIMO_IS_ARCHIVE (self), NULL);
 
@@ -201,15 +306,211 @@ GPtrArray* gimo_archive_query_objects (GimoArchive *self)
 
     g_mutex_lock (&priv->mutex);
 
-    if (g_tree_nnodes (priv->objects) > 0) {
-        param = g_ptr_array_new_with_free_func (g_object_unref);
+    if (priv->entries->len > 0) {
+        param = g_ptr_array_new_full (priv->entries->len,
+                                      g_object_unref);
 
-        g_tree_foreach (priv->objects,
-                        _gimo_archive_query_objects,
-                        param);
+        for (i = 0; i < priv->entries->len; ++i) {
+            entry = g_ptr_array_index (priv->entries, i);
+            g_ptr_array_add (param, g_object_ref (entry->object));
+        }
     }
 
     g_mutex_unlock (&priv->mutex);
 
     return param;
 }
+
+/**
+ * gimo_archive_foreach:
+ * @self: a #GimoArchive
+ * @func: (scope call): the function called with the identifier and
+ *        the object, returns %TRUE to stop
+ * @user_data: user data passed to @func
+ *
+ * Call a function for each object in the archive, in the order they
+ * are added. The identifier is %NULL for anonymous objects. The archive
+ * is not locked while @func runs, so it may modify the archive.
+ */
+void gimo_archive_foreach (GimoArchive *self,
+                           GTraverseFunc func,
+                           gpointer user_data)
+{
+    GimoArchivePrivate *priv;
+    struct _ArchiveEntry *entry;
+    GPtrArray *items;
+    guint i;
+
+    g_return_if_fail (GIMO_IS_ARCHIVE (self));
+
+    priv = self->priv;
+
+    g_mutex_lock (&priv->mutex);
+
+    items = g_ptr_array_sized_new (priv->entries->len * 2);
+
+    for (i = 0; i < priv->entries->len; ++i) {
+        entry = g_ptr_array_index (priv->entries, i);
+        g_ptr_array_add (items, g_strdup (entry->id));
+        g_ptr_array_add (items, g_object_ref (entry->object));
+    }
+
+    g_mutex_unlock (&priv->mutex);
+
+    for (i = 0; i < items->len; i += 2) {
+        if (func (g_ptr_array_index (items, i),
+                  g_ptr_array_index (items, i + 1),
+                  user_data))
+        {
+            break;
+        }
+    }
+
+    for (i = 0; i < items->len; i += 2) {
+        g_free (g_ptr_array_index (items, i));
+        g_object_unref (g_ptr_array_index (items, i + 1));
+    }
+
+    g_ptr_array_unref (items);
+}
+
+/* Get a reference to the shared archive of @self, if any. */
+GimoArchive* _gimo_archive_dup_shared (GimoArchive *self)
+{
+    GimoArchivePrivate *priv = self->priv;
+    GimoArchive *shared;
+
+    g_mutex_lock (&priv->mutex);
+
+    shared = priv->shared;
+    if (shared)
+        g_object_ref (shared);
+
+    g_mutex_unlock (&priv->mutex);
+
+    return shared;
+}
+
+/* Check whether @archive is in the shared chain of @self. */
+static gboolean _gimo_archive_shares (GimoArchive *self,
+                                      GimoArchive *archive)
+{
+    GimoArchive *it, *next;
+    GSList *visited = NULL;
+    gboolean result = FALSE;
+
+    it = g_object_ref (self);
+
+    while (it && !result && !g_slist_find (visited, it)) {
+        result = (it == archive);
+        next = _gimo_archive_dup_shared (it);
+        visited = g_slist_prepend (visited, it);
+        it = next;
+    }
+
+    if (it)
+        g_object_unref (it);
+
+    g_slist_free_full (visited, g_object_unref);
+
+    return result;
+}
+
+/**
+ * gimo_archive_set_shared:
+ * @self: a #GimoArchive
+ * @shared: (allow-none): the archive of shared objects
+ *
+ * Set the archive where the references not found in @self are
+ * resolved, e.g. a table of objects shared by all the archives of
+ * a context. The shared archive is referenced, and it must not
+ * share @self in turn.
+ */
+void gimo_archive_set_shared (GimoArchive *self,
+                              GimoArchive *shared)
+{
+    GimoArchivePrivate *priv;
+    GimoArchive *old;
+
+    g_return_if_fail (GIMO_IS_ARCHIVE (self));
+    g_return_if_fail (NULL == shared || !_gimo_archive_shares (shared, self));
+
+    priv = self->priv;
+
+    if (shared)
+        g_object_ref (shared);
+
+    g_mutex_lock (&priv->mutex);
+
+    old = priv->shared;
+    priv->shared = shared;
+
+    g_mutex_unlock (&priv->mutex);
+
+    if (old)
+        g_object_unref (old);
+}
+
+/**
+ * gimo_archive_resolve_object:
+ * @self: a #GimoArchive
+ * @id: the object identifier
+ *
+ * Find a referenced object, in the archive first, then in its
+ * shared archives.
+ *
+ * Returns: (allow-none) (transfer full): a #GObject
+ */
+GObject* gimo_archive_resolve_object (GimoArchive *self,
+                                      const gchar *id)
+{
+    GimoArchive *it, *next;
+    GSList *visited = NULL;
+    GObject *object = NULL;
+
+    g_return_val_if_fail (GIMO_IS_ARCHIVE (self), NULL);
+    g_return_val_if_fail (id != NULL, NULL);
+
+    it = g_object_ref (self);
+
+    /* A cycle set up by concurrent calls is walked only once. */
+    while (it && !g_slist_find (visited, it)) {
+        object = gimo_archive_query_object (it, id);
+        if (object)
+            break;
+
+        next = _gimo_archive_dup_shared (it);
+        visited = g_slist_prepend (visited, it);
+        it = next;
+    }
+
+    if (it)
+        g_object_unref (it);
+
+    g_slist_free_full (visited, g_object_unref);
+
+    return object;
+}
+
+/*
+ * Deliver a top level object read by an archive reader, the object
+ * is kept only if no handler takes it.
+ */
+gboolean _gimo_archive_object_parsed (GimoArchive *self,
+                                      const gchar *id,
+                                      GObject *object)
+{
+    gboolean handled = FALSE;
+
+    g_signal_emit (self,
+                   archive_signals[SIG_OBJECTPARSED],
+                   0,
+                   id,
+                   object,
+                   &handled);
+
+    if (handled)
+        return TRUE;
+
+    return gimo_archive_add_object (self, id, object);
+}
@@ -50,6 +50,12 @@ struct _GimoArchiveClass {
                       const gchar *file_name);
     gboolean (*save) (GimoArchive *self,
                       const gchar *file_name);
+    gboolean (*read_data) (GimoArchive *self,
+                           const gchar *data,
+                           gsize length);
+    gboolean (*object_parsed) (GimoArchive *self,
+                               const gchar *id,
+                               GObject *object);
 };
 
 GType gimo_archive_get_type (void) G_GNUC_CONST;
@@ -59,6 +65,13 @@ GimoArchive* gimo_archive_new (void);
 gboolean gimo_archive_read (GimoArchive *self,
                             const gchar *file_name);
 
+gboolean gimo_archive_read_data (GimoArchive *self,
+                                 const gchar *data,
+                                 gsize length);
+
+gboolean gimo_archive_read_bytes (GimoArchive *self,
+                                  GBytes *bytes);
+
 gboolean gimo_archive_save (GimoArchive *self,
                             const gchar *file_name);
 
@@ -74,6 +87,16 @@ GObject* gimo_archive_query_object (GimoArchive *self,
 
 GPtrArray* gimo_archive_query_objects (GimoArchive *self);
 
+void gimo_archive_foreach (GimoArchive *self,
+                           GTraverseFunc func,
+                           gpointer user_data);
+
+void gimo_archive_set_shared (GimoArchive *self,
+                              GimoArchive *shared);
+
+GObject* gimo_archive_resolve_object (GimoArchive *self,
+                                      const gchar *id);
+
 G_END_DECLS
 
 #endif /* __GIMO_ARCHIVE_H__ */
@@ -0,0 +1,220 @@
+/* GIMO - A plugin framework based on GObject.
+ *
+ * Copyright (C) 2012 TinySoft, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * MT safe
+ */
+
+#include "gimo-builtin.h"
+#include "gimo-error.h"
+#include <gmodule.h>
+#include <string.h>
+
+struct _GimoBuiltinPrivate {
+    const GimoBuiltinEntry *entry;
+};
+
+static GimoBuiltinEntry *builtin_entries;
+
+G_LOCK_DEFINE_STATIC (builtin_lock);
+
+static void gimo_loadable_interface_init (GimoLoadableInterface *iface);
+static void gimo_module_interface_init (GimoModuleInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GimoBuiltin, gimo_builtin, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GIMO_TYPE_LOADABLE,
+                                                gimo_loadable_interface_init);
+                         G_IMPLEMENT_INTERFACE (GIMO_TYPE_MODULE,
+                                                gimo_module_interface_init))
+
+/*
+ * Find a registered module by file name. The directory is ignored,
+ * and so is a shared library suffix, but a script like "foo.py"
+ * never matches the built-in "foo".
+ */
+static const GimoBuiltinEntry* _gimo_builtin_lookup (const gchar *file_name)
+{
+    const GimoBuiltinEntry *it;
+    const gchar *base_name;
+    const gchar *suffix;
+    const gchar *p;
+    gsize length;
+
+    base_name = file_name;
+    for (p = file_name; *p; ++p) {
+        if (G_IS_DIR_SEPARATOR (*p))
+            base_name = p + 1;
+    }
+
+    length = strlen (base_name);
+    suffix = strrchr (base_name, '.');
+    if (suffix && (!strcmp (suffix + 1, "so") ||
+                   !strcmp (suffix + 1, G_MODULE_SUFFIX)))
+    {
+        length = (gsize) (suffix - base_name);
+    }
+
+    G_LOCK (builtin_lock);
+
+    it = builtin_entries;
+    while (it) {
+        if (strlen (it->name) == length &&
+            !strncmp (it->name, base_name, length))
+        {
+            break;
+        }
+
+        it = it->next;
+    }
+
+    G_UNLOCK (builtin_lock);
+
+    return it;
+}
+
+static gboolean _gimo_builtin_open (GimoModule *module,
+                                    const gchar *file_name)
+{
+    GimoBuiltin *self = GIMO_BUILTIN (module);
+    GimoBuiltinPrivate *priv = self->priv;
+
+    if (priv->entry)
+        gimo_set_error_return_val (GIMO_ERROR_CONFLICT, FALSE);
+
+    priv->entry = file_name ? _gimo_builtin_lookup (file_name) : NULL;
+    if (NULL == priv->entry) {
+        gimo_set_error_full (GIMO_ERROR_LOAD,
+                             "Builtin: module not registered: %s",
+                             file_name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean _gimo_builtin_close (GimoModule *module)
+{
+    GimoBuiltin *self = GIMO_BUILTIN (module);
+
+    self->priv->entry = NULL;
+
+    return TRUE;
+}
+
+static const gchar* _gimo_builtin_get_name (GimoModule *module)
+{
+    GimoBuiltin *self = GIMO_BUILTIN (module);
+    GimoBuiltinPrivate *priv = self->priv;
+
+    if (priv->entry)
+        return priv->entry->name;
+
+    return NULL;
+}
+
+static GObject* _gimo_builtin_resolve (GimoModule *module,
+                                       const gchar *symbol,
+                                       GObject *param)
+{
+    GimoBuiltin *self = GIMO_BUILTIN (module);
+    GimoBuiltinPrivate *priv = self->priv;
+    const GimoModuleSymbol *it;
+
+    if (priv->entry) {
+        for (it = priv->entry->symbols; it->name; ++it) {
+            if (!strcmp (it->name, symbol))
+                return it->func ? it->func (param) : NULL;
+        }
+    }
+
+    gimo_set_error_full (GIMO_ERROR_NO_SYMBOL,
+                         "Builtin: symbol not found: %s",
+                         symbol);
+    return NULL;
+}
+
+static void gimo_loadable_interface_init (GimoLoadableInterface *iface)
+{
+    iface->load = (GimoLoadableLoadFunc) _gimo_builtin_open;
+    iface->unload = (GimoLoadableUnloadFunc) _gimo_builtin_close;
+}
+
+static void gimo_module_interface_init (GimoModuleInterface *iface)
+{
+    iface->open = _gimo_builtin_open;
+    iface->close = _gimo_builtin_close;
+    iface->get_name = _gimo_builtin_get_name;
+    iface->resolve = _gimo_builtin_resolve;
+}
+
+static void gimo_builtin_init (GimoBuiltin *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              GIMO_TYPE_BUILTIN,
+                                              GimoBuiltinPrivate);
+    self->priv->entry = NULL;
+}
+
+static void gimo_builtin_class_init (GimoBuiltinClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (gobject_class,
+                              sizeof (GimoBuiltinPrivate));
+}
+
+GimoBuiltin* gimo_builtin_new (void)
+{
+    return g_object_new (GIMO_TYPE_BUILTIN, NULL);
+}
+
+/**
+ * gimo_builtin_register: (skip)
+ * @entry: a static #GimoBuiltinEntry
+ *
+ * Register a module statically linked into the executable, it's
+ * usually called by the constructor GIMO_BUILTIN_END() defines.
+ * A plugin whose module is registered resolves its symbols from
+ * the table instead of opening a shared library.
+ */
+void gimo_builtin_register (GimoBuiltinEntry *entry)
+{
+    G_LOCK (builtin_lock);
+
+    entry->next = builtin_entries;
+    builtin_entries = entry;
+
+    G_UNLOCK (builtin_lock);
+}
+
+/**
+ * gimo_builtin_exists:
+ * @name: the module file name
+ *
+ * Check whether a module of the name is built in.
+ *
+ * Returns: %TRUE if the module is registered.
+ */
+gboolean gimo_builtin_exists (const gchar *name)
+{
+    g_return_val_if_fail (name != NULL, FALSE);
+
+    return _gimo_builtin_lookup (name) != NULL;
+}
@@ -0,0 +1,137 @@
+/* GIMO - A plugin framework based on GObject.
+ *
+ * Copyright (C) 2012 TinySoft, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#ifndef __GIMO_BUILTIN_H__
+#define __GIMO_BUILTIN_H__
+
+#include "gimo-loadable.h"
+#include "gimo-module.h"
+
+G_BEGIN_DECLS
+
+#define GIMO_TYPE_BUILTIN (gimo_builtin_get_type())
+#define GIMO_BUILTIN(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj), GIMO_TYPE_BUILTIN, GimoBuiltin))
+#define GIMO_IS_BUILTIN(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), GIMO_TYPE_BUILTIN))
+#define GIMO_BUILTIN_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST((klass), GIMO_TYPE_BUILTIN, GimoBuiltinClass))
+#define GIMO_IS_BUILTIN_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE((klass), GIMO_TYPE_BUILTIN))
+#define GIMO_BUILTIN_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS((obj), GIMO_TYPE_BUILTIN, GimoBuiltinClass))
+
+typedef struct _GimoBuiltin GimoBuiltin;
+typedef struct _GimoBuiltinPrivate GimoBuiltinPrivate;
+typedef struct _GimoBuiltinClass GimoBuiltinClass;
+typedef struct _GimoBuiltinEntry GimoBuiltinEntry;
+
+struct _GimoBuiltin {
+    GObject parent_instance;
+    GimoBuiltinPrivate *priv;
+};
+
+struct _GimoBuiltinClass {
+    GObjectClass parent_class;
+};
+
+/**
+ * GimoBuiltinEntry:
+ * @name: the module name, without directory and module suffix
+ * @symbols: the symbol table, terminated by a %NULL name
+ * @next: private, link of the registry
+ *
+ * A module statically linked into the executable.
+ */
+struct _GimoBuiltinEntry {
+    const gchar *name;
+    const GimoModuleSymbol *symbols;
+    GimoBuiltinEntry *next;
+};
+
+#if defined (__GNUC__)
+#define GIMO_BUILTIN_CONSTRUCTOR(func) \
+    static void func (void) __attribute__ ((constructor)); \
+    static void func (void)
+#elif defined (_MSC_VER)
+#if defined (_M_IX86)
+#define GIMO_BUILTIN_SYMBOL_PREFIX "_"
+#else
+#define GIMO_BUILTIN_SYMBOL_PREFIX ""
+#endif
+/*
+ * The initializer must be external for /include to keep it from
+ * being stripped, it's named after the module id, so it collides
+ * only when two built-ins share an id.
+ */
+#define GIMO_BUILTIN_CONSTRUCTOR(func) \
+    static void __cdecl func (void); \
+    __pragma (section (".CRT$XCU", read)) \
+    __declspec (allocate (".CRT$XCU")) \
+    void (__cdecl *func##_init) (void) = func; \
+    __pragma (comment (linker, "/include:" \
+                       GIMO_BUILTIN_SYMBOL_PREFIX #func "_init")) \
+    static void __cdecl func (void)
+#else
+/* Fails only where a built-in module is declared. */
+#define GIMO_BUILTIN_CONSTRUCTOR(func) \
+    typedef char func##_requires_compiler_constructor_support[-1]; \
+    static void func (void)
+#endif
+
+/*
+ * Declare a built-in module, it's registered before main() is run:
+ *
+ *   GIMO_BUILTIN_BEGIN (demo)
+ *       GIMO_BUILTIN_SYMBOL (demo_plugin_new)
+ *   GIMO_BUILTIN_END (demo, "demo-plugin")
+ *
+ * The id must be unique in the executable. The object file must be
+ * linked into the executable, an unreferenced member of a static
+ * library is dropped by the linker. A compiler without constructor
+ * support fails to compile the declaration.
+ */
+#define GIMO_BUILTIN_BEGIN(id) \
+    static const GimoModuleSymbol _gimo_builtin_##id##_symbols[] = {
+
+#define GIMO_BUILTIN_SYMBOL(func) \
+        { #func, (GimoModuleFunc) func },
+
+#define GIMO_BUILTIN_END(id, name) \
+        { NULL, NULL } \
+    }; \
+    static GimoBuiltinEntry _gimo_builtin_##id##_entry = { \
+        name, _gimo_builtin_##id##_symbols, NULL \
+    }; \
+    GIMO_BUILTIN_CONSTRUCTOR (_gimo_builtin_##id##_register) \
+    { \
+        gimo_builtin_register (&_gimo_builtin_##id##_entry); \
+    }
+
+GType gimo_builtin_get_type (void) G_GNUC_CONST;
+
+GimoBuiltin* gimo_builtin_new (void);
+
+void gimo_builtin_register (GimoBuiltinEntry *entry);
+
+gboolean gimo_builtin_exists (const gchar *name);
+
+G_END_DECLS
+
+#endif /* __GIMO_BUILTIN_H__ */
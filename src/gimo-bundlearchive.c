@@ -0,0 +1,433 @@
+/* GIMO - A plugin framework based on GObject.
+ *
+ * Copyright (C) 2012 TinySoft, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+#include "gimo-bundlearchive.h"
+#include "gimo-error.h"
+#include "gimo-xmlarchive.h"
+#include <string.h>
+
+/*
+ * A bundle packs many archives into one file, so a whole plugin set
+ * is read with one open and one sequential read.
+ *
+ * The layout, all integers are 32 bits little endian:
+ *   "GIMOBNDL", version, count
+ *   count * { name offset, name length, data offset, data length }
+ *   names and data
+ *
+ * Each entry is an XML archive, it's read as a #GimoXmlArchive and
+ * delivered as a top level object with the entry name as identifier.
+ * A reference in an entry is resolved in the entry, then in the named
+ * objects of the entries before it, then in the shared archive of the
+ * bundle.
+ */
+
+#define BUNDLE_MAGIC "GIMOBNDL"
+#define BUNDLE_MAGIC_SIZE 8
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE (BUNDLE_MAGIC_SIZE + 8)
+#define BUNDLE_INDEX_SIZE 16
+
+extern gboolean _gimo_archive_object_parsed (GimoArchive *self,
+                                             const gchar *id,
+                                             GObject *object);
+
+extern GimoArchive* _gimo_archive_dup_shared (GimoArchive *self);
+
+static void gimo_loadable_interface_init (GimoLoadableInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GimoBundleArchive, gimo_bundlearchive, GIMO_TYPE_ARCHIVE,
+                         G_IMPLEMENT_INTERFACE (GIMO_TYPE_LOADABLE,
+                                                gimo_loadable_interface_init))
+
+static guint32 _gimo_bundle_read_uint32 (const gchar *data)
+{
+    guint32 value;
+
+    memcpy (&value, data, sizeof (value));
+
+    return GUINT32_FROM_LE (value);
+}
+
+static void _gimo_bundle_write_uint32 (GString *buffer,
+                                       guint32 value)
+{
+    value = GUINT32_TO_LE (value);
+    g_string_append_len (buffer, (const gchar *) &value, sizeof (value));
+}
+
+static gboolean _gimo_bundle_add_scope (gpointer key,
+                                        gpointer value,
+                                        gpointer data)
+{
+    if (key)
+        gimo_archive_add_object (data, key, value);
+
+    return FALSE;
+}
+
+static gboolean _gimo_bundlearchive_parse (GimoArchive *self,
+                                            const gchar *data,
+                                            gsize length)
+{
+    const gchar *index;
+    guint32 count, i;
+    guint32 name_off, name_len, data_off, data_len;
+    GimoArchive *scope;
+    GimoArchive *shared;
+    GimoArchive *archive;
+    gchar *name;
+    gboolean result = TRUE;
+
+    if (length < BUNDLE_HEADER_SIZE ||
+        memcmp (data, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE))
+    {
+        gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                             "BundleArchive invalid header");
+        return FALSE;
+    }
+
+    if (_gimo_bundle_read_uint32 (data + BUNDLE_MAGIC_SIZE) != BUNDLE_VERSION) {
+        gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                             "BundleArchive invalid version: %u",
+                             _gimo_bundle_read_uint32 (data + BUNDLE_MAGIC_SIZE));
+        return FALSE;
+    }
+
+    count = _gimo_bundle_read_uint32 (data + BUNDLE_MAGIC_SIZE + 4);
+    if (count > (length - BUNDLE_HEADER_SIZE) / BUNDLE_INDEX_SIZE) {
+        gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                             "BundleArchive invalid count: %u", count);
+        return FALSE;
+    }
+
+    index = data + BUNDLE_HEADER_SIZE;
+
+    /*
+     * The named objects of the parsed entries, not the entry archives
+     * kept by the bundle, so a reference never resolves to a whole
+     * entry. The entries are unlinked from the scope after the read,
+     * so a cached bundle doesn't keep the shared objects alive.
+     */
+    scope = gimo_archive_new ();
+    shared = _gimo_archive_dup_shared (self);
+    if (shared) {
+        gimo_archive_set_shared (scope, shared);
+        g_object_unref (shared);
+    }
+
+    for (i = 0; i < count && result; ++i, index += BUNDLE_INDEX_SIZE) {
+        name_off = _gimo_bundle_read_uint32 (index);
+        name_len = _gimo_bundle_read_uint32 (index + 4);
+        data_off = _gimo_bundle_read_uint32 (index + 8);
+        data_len = _gimo_bundle_read_uint32 (index + 12);
+
+        if (name_off > length || name_len > length - name_off ||
+            data_off > length || data_len > length - data_off)
+        {
+            gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                                 "BundleArchive invalid entry: %u", i);
+            result = FALSE;
+            break;
+        }
+
+        archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+        name = g_strndup (data + name_off, name_len);
+
+        gimo_archive_set_shared (archive, scope);
+
+        result = gimo_archive_read_data (archive, data + data_off, data_len);
+        gimo_archive_set_shared (archive, NULL);
+
+        if (result) {
+            /* The first entry defining an identifier wins. */
+            gimo_archive_foreach (archive, _gimo_bundle_add_scope, scope);
+
+            result = _gimo_archive_object_parsed (self,
+                                                  name,
+                                                  G_OBJECT (archive));
+            if (!result) {
+                gimo_set_error_full (GIMO_ERROR_CONFLICT,
+                                     "BundleArchive duplicate entry: %s",
+                                     name);
+            }
+        }
+
+        g_free (name);
+        g_object_unref (archive);
+    }
+
+    gimo_archive_set_shared (scope, NULL);
+    g_object_unref (scope);
+
+    return result;
+}
+
+static gboolean _gimo_bundlearchive_read (GimoArchive *self,
+                                           const gchar *file_name)
+{
+    GMappedFile *file;
+    gboolean result;
+
+    file = g_mapped_file_new (file_name, FALSE, NULL);
+    if (NULL == file)
+        gimo_set_error_return_val (GIMO_ERROR_OPEN_FILE, FALSE);
+
+    result = _gimo_bundlearchive_parse (self,
+                                         g_mapped_file_get_contents (file),
+                                         g_mapped_file_get_length (file));
+
+    g_mapped_file_unref (file);
+
+    return result;
+}
+
+/*
+ * Write a bundle of the named contents, the file is replaced
+ * atomically.
+ */
+static gboolean _gimo_bundle_write (const gchar *file_name,
+                                    GPtrArray *names,
+                                    GPtrArray *contents)
+{
+    GString *buffer;
+    GError *error = NULL;
+    GBytes *bytes;
+    const gchar *name;
+    gsize offset, size;
+    guint i;
+    gboolean result;
+
+    g_assert (names->len == contents->len);
+
+    buffer = g_string_new (BUNDLE_MAGIC);
+    _gimo_bundle_write_uint32 (buffer, BUNDLE_VERSION);
+    _gimo_bundle_write_uint32 (buffer, names->len);
+
+    offset = BUNDLE_HEADER_SIZE + names->len * BUNDLE_INDEX_SIZE;
+
+    for (i = 0; i < names->len; ++i) {
+        name = g_ptr_array_index (names, i);
+        size = g_bytes_get_size (g_ptr_array_index (contents, i));
+
+        _gimo_bundle_write_uint32 (buffer, offset);
+        _gimo_bundle_write_uint32 (buffer, strlen (name));
+        offset += strlen (name);
+
+        _gimo_bundle_write_uint32 (buffer, offset);
+        _gimo_bundle_write_uint32 (buffer, size);
+        offset += size;
+    }
+
+    if (offset > G_MAXUINT32) {
+        g_string_free (buffer, TRUE);
+        gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                             "BundleArchive too large: %s", file_name);
+        return FALSE;
+    }
+
+    for (i = 0; i < names->len; ++i) {
+        gconstpointer data;
+
+        g_string_append (buffer, g_ptr_array_index (names, i));
+
+        bytes = g_ptr_array_index (contents, i);
+        data = g_bytes_get_data (bytes, &size);
+        g_string_append_len (buffer, data, size);
+    }
+
+    result = g_file_set_contents (file_name,
+                                  buffer->str,
+                                  buffer->len,
+                                  &error);
+    if (!result) {
+        gimo_set_error_full (GIMO_ERROR_OPEN_FILE,
+                             "BundleArchive write error: %s",
+                             error->message);
+        g_error_free (error);
+    }
+
+    g_string_free (buffer, TRUE);
+
+    return result;
+}
+
+struct _SaveContext {
+    GPtrArray *names;
+    GPtrArray *contents;
+    gboolean error;
+};
+
+static gboolean _gimo_bundlearchive_save_entry (gpointer key,
+                                                 gpointer value,
+                                                 gpointer data)
+{
+    struct _SaveContext *sc = data;
+    GOutputStream *stream;
+    GMemoryOutputStream *mstream;
+
+    if (NULL == key || !GIMO_IS_XMLARCHIVE (value)) {
+        g_warning ("BundleArchive entry not named XML archive: %s",
+                   key ? (const gchar *) key : "(null)");
+        return FALSE;
+    }
+
+    stream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+    mstream = G_MEMORY_OUTPUT_STREAM (stream);
+
+    if (gimo_xmlarchive_write (value, stream, TRUE, NULL) &&
+        g_output_stream_close (stream, NULL, NULL))
+    {
+        g_ptr_array_add (sc->names, g_strdup (key));
+        g_ptr_array_add (sc->contents,
+                         g_bytes_new (g_memory_output_stream_get_data (mstream),
+                                      g_memory_output_stream_get_data_size (mstream)));
+    }
+    else {
+        sc->error = TRUE;
+    }
+
+    g_object_unref (stream);
+
+    return sc->error;
+}
+
+static gboolean _gimo_bundlearchive_save (GimoArchive *self,
+                                           const gchar *file_name)
+{
+    struct _SaveContext sc;
+    gboolean result = FALSE;
+
+    sc.names = g_ptr_array_new_with_free_func (g_free);
+    sc.contents = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) g_bytes_unref);
+    sc.error = FALSE;
+
+    gimo_archive_foreach (self, _gimo_bundlearchive_save_entry, &sc);
+
+    if (!sc.error)
+        result = _gimo_bundle_write (file_name, sc.names, sc.contents);
+
+    g_ptr_array_unref (sc.names);
+    g_ptr_array_unref (sc.contents);
+
+    return result;
+}
+
+static void gimo_loadable_interface_init (GimoLoadableInterface *iface)
+{
+    iface->load = (GimoLoadableLoadFunc) _gimo_bundlearchive_read;
+}
+
+static void gimo_bundlearchive_init (GimoBundleArchive *self)
+{
+}
+
+static void gimo_bundlearchive_class_init (GimoBundleArchiveClass *klass)
+{
+    GimoArchiveClass *archive_class = GIMO_ARCHIVE_CLASS (klass);
+
+    archive_class->read = _gimo_bundlearchive_read;
+    archive_class->save = _gimo_bundlearchive_save;
+    archive_class->read_data = _gimo_bundlearchive_parse;
+}
+
+GimoBundleArchive* gimo_bundlearchive_new (void)
+{
+    return g_object_new (GIMO_TYPE_BUNDLEARCHIVE, NULL);
+}
+
+/**
+ * gimo_bundlearchive_pack:
+ * @file_name: the bundle file name
+ * @base_dir: (allow-none): the directory the entry names are
+ *            relative to
+ * @files: (element-type utf8): the archive files, relative to
+ *         @base_dir or absolute under it
+ *
+ * Pack archive files into a bundle, the entry names are the paths
+ * relative to @base_dir with '/' separators.
+ *
+ * Returns: whether the bundle is written
+ */
+gboolean gimo_bundlearchive_pack (const gchar *file_name,
+                                   const gchar *base_dir,
+                                   GPtrArray *files)
+{
+    GPtrArray *names;
+    GPtrArray *contents;
+    const gchar *file;
+    gchar *path, *name, *data;
+    gsize length, base_len = 0;
+    gboolean result = TRUE;
+    guint i;
+
+    g_return_val_if_fail (file_name && files, FALSE);
+
+    if (base_dir)
+        base_len = strlen (base_dir);
+
+    names = g_ptr_array_new_with_free_func (g_free);
+    contents = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) g_bytes_unref);
+
+    for (i = 0; i < files->len && result; ++i) {
+        file = g_ptr_array_index (files, i);
+
+        if (base_dir && !g_path_is_absolute (file))
+            path = g_build_filename (base_dir, file, NULL);
+        else
+            path = g_strdup (file);
+
+        if (!g_file_get_contents (path, &data, &length, NULL)) {
+            gimo_set_error_full (GIMO_ERROR_OPEN_FILE,
+                                 "BundleArchive open file error: %s",
+                                 path);
+            g_free (path);
+            result = FALSE;
+            break;
+        }
+
+        name = path;
+        if (base_len > 0 && strncmp (path, base_dir, base_len) == 0) {
+            name += base_len;
+
+            while (G_IS_DIR_SEPARATOR (*name))
+                ++name;
+        }
+
+        name = g_strdup (name);
+#ifdef G_OS_WIN32
+        g_strdelimit (name, "\\", '/');
+#endif
+
+        g_ptr_array_add (names, name);
+        g_ptr_array_add (contents, g_bytes_new_take (data, length));
+        g_free (path);
+    }
+
+    if (result)
+        result = _gimo_bundle_write (file_name, names, contents);
+
+    g_ptr_array_unref (names);
+    g_ptr_array_unref (contents);
+
+    return result;
+}
@@ -43,6 +43,7 @@ extern void _gimo_plugin_install (GimoPlugin *self,
                                   GimoContext *context,
                                   const gchar *cur_path);
 extern void _gimo_plugin_uninstall (GimoPlugin *self);
+extern GimoDataStore* _gimo_plugin_checkpoint (GimoPlugin *self);
 
 G_DEFINE_TYPE (GimoContext, gimo_context, G_TYPE_OBJECT)
 
@@ -57,6 +58,7 @@ enum {
 struct _GimoContextPrivate {
     GTree *plugins;
     GQueue *paths;
+    GimoArchive *shared;
     GMutex mutex;
 };
 
@@ -65,6 +67,14 @@ struct _QueryExtension {
     GPtrArray *array;
 };
 
+struct _LoadPlugin {
+    GimoContext *self;
+    GimoLoader *mloader;
+    const gchar *cur_path;
+    GPtrArray **array;
+    guint count;
+};
+
 struct _PathInfo {
     gchar *path;
     gint ref_count;
@@ -94,56 +104,188 @@ static void _gimo_context_plugin_destroy (gpointer p)
     g_object_unref (p);
 }
 
-static guint _gimo_context_load_plugin (GimoContext *self,
-                                        GimoLoader *aloader,
-                                        GimoLoader *mloader,
-                                        const gchar *cur_path,
-                                        const gchar *file_name,
-                                        GPtrArray **array)
+/*
+ * Start reading the module of the plugin ahead in the background,
+ * while the rest of the archives are being parsed.
+ */
+static void _gimo_context_prefetch_module (GimoLoader *mloader,
+                                           GimoPlugin *plugin)
 {
-    GimoArchive *archive;
-    GPtrArray *objects;
-    GObject *object;
-    guint result = 0;
+    const gchar *path = gimo_plugin_get_path (plugin);
+    const gchar *module = gimo_plugin_get_module (plugin);
 
-    archive = gimo_safe_cast (gimo_loader_load (aloader, file_name),
-                              GIMO_TYPE_ARCHIVE);
-    if (NULL == archive)
+    if (NULL == mloader || NULL == module)
+        return;
+
+    if (path) {
+        gchar *full_path;
+        gboolean found;
+
+        full_path = g_build_filename (path, module, NULL);
+        found = gimo_loader_prefetch (mloader, full_path);
+        g_free (full_path);
+
+        if (found)
+            return;
+    }
+
+    gimo_loader_prefetch (mloader, module);
+}
+
+static gboolean _gimo_context_add_plugin (struct _LoadPlugin *lp,
+                                          GimoPlugin *plugin)
+{
+    if (!gimo_context_install_plugin (lp->self,
+                                      lp->cur_path,
+                                      plugin))
+    {
         return FALSE;
+    }
 
-    objects = gimo_archive_query_objects (archive);
-    if (objects) {
-        guint i;
+    _gimo_context_prefetch_module (lp->mloader, plugin);
 
-        for (i = 0; i < objects->len; ++i) {
-            object = g_ptr_array_index (objects, i);
+    if (lp->array) {
+        if (NULL == *lp->array)
+            *lp->array = g_ptr_array_new_with_free_func (g_object_unref);
 
-            if (!GIMO_IS_PLUGIN (object))
-                continue;
+        g_ptr_array_add (*lp->array, g_object_ref (plugin));
+    }
 
-            if (!gimo_context_install_plugin (self,
-                                              cur_path,
-                                              GIMO_PLUGIN (object)))
-            {
-                continue;
-            }
+    ++lp->count;
 
-            if (array) {
-                if (NULL == *array)
-                    *array = g_ptr_array_new_with_free_func (g_object_unref);
+    return TRUE;
+}
 
-                g_ptr_array_add (*array, g_object_ref (object));
-            }
+static gboolean _gimo_context_add_object (struct _LoadPlugin *lp,
+                                          const gchar *id,
+                                          GObject *object);
+
+static gboolean _gimo_context_add_entry (gpointer key,
+                                         gpointer value,
+                                         gpointer data)
+{
+    _gimo_context_add_object (data, key, value);
+
+    return FALSE;
+}
+
+/*
+ * Install a plugin, or the plugins of a nested archive such as a
+ * bundle entry, whose paths are relative to the directory of the
+ * entry name. Other named objects go to the shared archive, so the
+ * later archives can refer to them.
+ */
+static gboolean _gimo_context_add_object (struct _LoadPlugin *lp,
+                                          const gchar *id,
+                                          GObject *object)
+{
+    if (GIMO_IS_PLUGIN (object))
+        return _gimo_context_add_plugin (lp, GIMO_PLUGIN (object));
+
+    if (GIMO_IS_ARCHIVE (object)) {
+        const gchar *cur_path = lp->cur_path;
+        gchar *dir_name = NULL;
+        gchar *sub_path = NULL;
 
-            ++result;
+        if (id) {
+            dir_name = g_path_get_dirname (id);
+
+            if (strcmp (dir_name, ".") != 0) {
+                if (cur_path)
+                    sub_path = g_build_filename (cur_path, dir_name, NULL);
+                else
+                    sub_path = g_strdup (dir_name);
+
+                lp->cur_path = sub_path;
+            }
         }
 
-        g_ptr_array_unref (objects);
+        gimo_archive_foreach (GIMO_ARCHIVE (object),
+                              _gimo_context_add_entry,
+                              lp);
+
+        lp->cur_path = cur_path;
+        g_free (sub_path);
+        g_free (dir_name);
+
+        return TRUE;
     }
 
+    if (id)
+        return gimo_archive_add_object (lp->self->priv->shared, id, object);
+
+    return FALSE;
+}
+
+/* Install the plugins while the archive is still being read. */
+static gboolean _gimo_context_object_parsed (GimoArchive *archive,
+                                             const gchar *id,
+                                             GObject *object,
+                                             gpointer user_data)
+{
+    if (GIMO_IS_PLUGIN (object) || GIMO_IS_ARCHIVE (object)) {
+        _gimo_context_add_object (user_data, id, object);
+        return TRUE;
+    }
+
+    /* Named objects are shared, the others stay in the archive. */
+    return _gimo_context_add_object (user_data, id, object);
+}
+
+static void _gimo_context_setup_archive (GimoLoadable *object,
+                                         gpointer user_data)
+{
+    struct _LoadPlugin *lp = user_data;
+
+    if (GIMO_IS_ARCHIVE (object)) {
+        gimo_archive_set_shared (GIMO_ARCHIVE (object),
+                                 lp->self->priv->shared);
+
+        g_signal_connect (object,
+                          "object-parsed",
+                          G_CALLBACK (_gimo_context_object_parsed),
+                          user_data);
+    }
+}
+
+static guint _gimo_context_load_plugin (GimoContext *self,
+                                        GimoLoader *aloader,
+                                        GimoLoader *mloader,
+                                        const gchar *cur_path,
+                                        const gchar *file_name,
+                                        GPtrArray **array)
+{
+    struct _LoadPlugin lp;
+    GimoArchive *archive;
+
+    lp.self = self;
+    lp.mloader = mloader;
+    lp.cur_path = cur_path;
+    lp.array = array;
+    lp.count = 0;
+
+    /* The plugins are taken while the archive is read, the archive
+     * loader must not be cached or a hit would install nothing. */
+    archive = gimo_safe_cast (
+        gimo_loader_load_full (aloader,
+                               file_name,
+                               _gimo_context_setup_archive,
+                               &lp),
+        GIMO_TYPE_ARCHIVE);
+    if (NULL == archive)
+        return lp.count;
+
+    g_signal_handlers_disconnect_by_func (archive,
+                                          _gimo_context_object_parsed,
+                                          &lp);
+
+    /* The references are resolved, a cached archive must not keep
+     * the shared objects of the context alive. */
+    gimo_archive_set_shared (archive, NULL);
+
     g_object_unref (archive);
 
-    return result;
+    return lp.count;
 }
 
 static guint _gimo_context_load_plugins (GimoContext *self,
@@ -295,6 +437,7 @@ static void gimo_context_init (GimoContext *self)
                                      NULL, NULL,
                                      _gimo_context_plugin_destroy);
     priv->paths = g_queue_new ();
+    priv->shared = gimo_archive_new ();
     g_mutex_init (&priv->mutex);
 }
 
@@ -382,6 +525,7 @@ static void gimo_context_finalize (GObject *gobject)
      * be destroyed after all other plugins. */
     loader = gimo_context_resolve_extpoint (self,
                                             "org.gimo.core.loader.module");
+    g_object_unref (priv->shared);
     g_tree_unref (priv->plugins);
     g_queue_free_full (priv->paths, _path_info_unref);
     g_mutex_clear (&priv->mutex);
@@ -924,6 +1068,23 @@ done:
     return object;
 }
 
+/**
+ * gimo_context_query_shared:
+ * @self: a #GimoContext
+ *
+ * Query the archive of the objects shared by the plugin archives,
+ * the named top level objects that are not plugins are added to it
+ * and ref="ID" attributes are resolved against it.
+ *
+ * Returns: (transfer full): a #GimoArchive
+ */
+GimoArchive* gimo_context_query_shared (GimoContext *self)
+{
+    g_return_val_if_fail (GIMO_IS_CONTEXT (self), NULL);
+
+    return g_object_ref (self->priv->shared);
+}
+
 void gimo_context_run_plugins (GimoContext *self)
 {
     GPtrArray *plugins;
@@ -961,6 +1122,22 @@ void gimo_context_call_gc (GimoContext *self,
                    maybe_gc);
 }
 
+/**
+ * gimo_context_save:
+ * @self: a #GimoContext
+ * @store: the store where the state of each plugin is put
+ *
+ * Save the state of the plugins to @store, as a #GimoDataStore of
+ * each plugin set by the plugin identifier.
+ *
+ * Only the dirty plugins are saved again, the others put the store
+ * of their last checkpoint. So the plugin stores are shared with the
+ * plugin and every later save until the plugin changes, they must
+ * be treated as read-only, copy one before modifying it. A save
+ * running in another thread waits for the plugins being saved, and
+ * gets their fresh stores. A save from a #GimoPlugin::save handler
+ * gets the last checkpoint of the plugin being saved.
+ */
 void gimo_context_save (GimoContext *self,
                         GimoDataStore *store)
 {
@@ -974,8 +1151,7 @@ void gimo_context_save (GimoContext *self,
 
         for (i = 0; i < plugins->len; ++i) {
             p = g_ptr_array_index (plugins, i);
-            s = gimo_data_store_new ();
-            gimo_plugin_save (p, s);
+            s = _gimo_plugin_checkpoint (p);
             gimo_data_store_set_object (store,
                                         gimo_plugin_get_id (p),
                                         G_OBJECT (s));
@@ -1017,6 +1193,9 @@ void gimo_context_destroy (GimoContext *self)
             self, "org.gimo.core.loader.module"),
         GIMO_TYPE_LOADER);
 
+    /* Release the modules whose objects have died during stopping. */
+    _gimo_dlmodule_collect ();
+
     array = gimo_loader_query_cached (loader);
 
     if (array) {
@@ -92,6 +92,8 @@ GPtrArray* gimo_context_query_extensions (GimoContext *self,
 GObject* gimo_context_resolve_extpoint (GimoContext *self,
                                         const gchar *extpt_id);
 
+GimoArchive* gimo_context_query_shared (GimoContext *self);
+
 void gimo_context_run_plugins (GimoContext *self);
 
 void gimo_context_async_run (GimoContext *self,
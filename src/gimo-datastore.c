@@ -19,18 +19,57 @@
  */
 
 /*
- * MT safe
+ * MT safe, except the values borrowed by the get functions
  */
 
 #include "gimo-datastore.h"
-#include "gimo-utils.h"
+#include "gimo-error.h"
 #include <stdlib.h>
 #include <string.h>
 
 G_DEFINE_TYPE (GimoDataStore, gimo_data_store, G_TYPE_OBJECT)
 
+/*
+ * The values are kept inline in an open addressing hash table keyed
+ * by quark, with linear probing. A removed entry leaves a tombstone
+ * until the table is rehashed.
+ */
+struct _DataEntry {
+    GQuark key;
+    GValue value;
+};
+
+struct _DataTable {
+    struct _DataEntry *entries;
+    guint size;
+    guint used;
+    guint filled;
+};
+
+/*
+ * The keys are spread over shards by the high bits of the hash, each
+ * shard has its own lock, so the accesses to different keys rarely
+ * contend.
+ */
+struct _DataShard {
+    struct _DataTable table;
+    GRWLock lock;
+};
+
+struct _DataItem {
+    GQuark key;
+    GValue value;
+};
+
+#define DATA_TABLE_MIN_SIZE 8
+#define DATA_TOMBSTONE G_MAXUINT32
+#define DATA_SHARD_BITS 3
+#define DATA_SHARD_COUNT (1 << DATA_SHARD_BITS)
+
 struct _GimoDataStorePrivate {
-    GTree *datas;
+    struct _DataShard shards[DATA_SHARD_COUNT];
+    GSList *backings;
+    GMutex mutex;
 };
 
 G_LOCK_DEFINE_STATIC (bind_lock);
@@ -80,26 +119,367 @@ static void _gimo_data_value_destroy (gpointer x)
     g_free (p);
 }
 
+static guint _data_table_hash (GQuark key)
+{
+    guint hash = key * 2654435761U;
+
+    return hash ^ (hash >> 16);
+}
+
+static struct _DataEntry* _data_table_lookup (struct _DataTable *t,
+                                              GQuark key)
+{
+    struct _DataEntry *e;
+    guint i;
+
+    /* The markers of the free and removed entries are never keys. */
+    if (NULL == t->entries || 0 == key || DATA_TOMBSTONE == key)
+        return NULL;
+
+    i = _data_table_hash (key) & (t->size - 1);
+
+    for (;;) {
+        e = &t->entries[i];
+
+        if (e->key == key)
+            return e;
+
+        if (0 == e->key)
+            return NULL;
+
+        i = (i + 1) & (t->size - 1);
+    }
+}
+
+/* The values are moved, a GValue holds no pointer to itself. */
+static void _data_table_resize (struct _DataTable *t,
+                                guint size)
+{
+    struct _DataEntry *old = t->entries;
+    struct _DataEntry *e;
+    guint old_size = t->size;
+    guint i, j;
+
+    t->entries = g_new0 (struct _DataEntry, size);
+    t->size = size;
+    t->filled = t->used;
+
+    for (i = 0; i < old_size; ++i) {
+        if (0 == old[i].key || DATA_TOMBSTONE == old[i].key)
+            continue;
+
+        j = _data_table_hash (old[i].key) & (size - 1);
+        while (t->entries[j].key)
+            j = (j + 1) & (size - 1);
+
+        e = &t->entries[j];
+        e->key = old[i].key;
+        e->value = old[i].value;
+    }
+
+    g_free (old);
+}
+
+/*
+ * Find the entry of the key, or take a free one for it with an
+ * unset value.
+ */
+static struct _DataEntry* _data_table_insert (struct _DataTable *t,
+                                              GQuark key)
+{
+    struct _DataEntry *e, *free_entry = NULL;
+    guint i;
+
+    g_assert (key != 0 && key != DATA_TOMBSTONE);
+
+    /* Keep the load including tombstones under 3/4. */
+    if ((t->filled + 1) * 4 > t->size * 3) {
+        guint size = MAX (t->size, DATA_TABLE_MIN_SIZE);
+
+        while ((t->used + 1) * 2 > size)
+            size *= 2;
+
+        _data_table_resize (t, size);
+    }
+
+    i = _data_table_hash (key) & (t->size - 1);
+
+    for (;;) {
+        e = &t->entries[i];
+
+        if (e->key == key)
+            return e;
+
+        if (0 == e->key)
+            break;
+
+        if (DATA_TOMBSTONE == e->key && NULL == free_entry)
+            free_entry = e;
+
+        i = (i + 1) & (t->size - 1);
+    }
+
+    if (NULL == free_entry) {
+        free_entry = e;
+        ++t->filled;
+    }
+
+    free_entry->key = key;
+    ++t->used;
+
+    return free_entry;
+}
+
+static void _data_table_remove (struct _DataTable *t,
+                                GQuark key)
+{
+    struct _DataEntry *e = _data_table_lookup (t, key);
+
+    if (e) {
+        g_value_unset (&e->value);
+        e->key = DATA_TOMBSTONE;
+        --t->used;
+    }
+}
+
+static void _data_table_clear (struct _DataTable *t)
+{
+    guint i;
+
+    for (i = 0; i < t->size; ++i) {
+        if (t->entries[i].key && t->entries[i].key != DATA_TOMBSTONE)
+            g_value_unset (&t->entries[i].value);
+    }
+
+    g_free (t->entries);
+    t->entries = NULL;
+    t->size = t->used = t->filled = 0;
+}
+
+static struct _DataShard* _gimo_data_store_shard (GimoDataStore *self,
+                                                   GQuark key)
+{
+    guint i = _data_table_hash (key) >> (32 - DATA_SHARD_BITS);
+
+    return &self->priv->shards[i];
+}
+
+/*
+ * Insert a value, the contents of @value are taken without copying
+ * if @copy is %FALSE. A value of the same type is overwritten in
+ * place.
+ */
+static void _gimo_data_store_insert (GimoDataStore *self,
+                                     GQuark key,
+                                     const GValue *value,
+                                     gboolean copy)
+{
+    struct _DataShard *shard = _gimo_data_store_shard (self, key);
+    struct _DataTable *t = &shard->table;
+    struct _DataEntry *e;
+    GValue temp = G_VALUE_INIT;
+
+    g_rw_lock_writer_lock (&shard->lock);
+
+    /* A value of the table itself may be moved by a resize. */
+    if (copy && t->entries &&
+        (gconstpointer) value >= (gconstpointer) t->entries &&
+        (gconstpointer) value < (gconstpointer) (t->entries + t->size))
+    {
+        g_value_init (&temp, G_VALUE_TYPE (value));
+        g_value_copy (value, &temp);
+        value = &temp;
+        copy = FALSE;
+    }
+
+    e = _data_table_insert (t, key);
+
+    if (G_IS_VALUE (&e->value)) {
+        if (copy && G_VALUE_TYPE (&e->value) == G_VALUE_TYPE (value)) {
+            g_value_copy (value, &e->value);
+            goto done;
+        }
+
+        g_value_unset (&e->value);
+    }
+
+    if (copy) {
+        g_value_init (&e->value, G_VALUE_TYPE (value));
+        g_value_copy (value, &e->value);
+    }
+    else {
+        e->value = *value;
+    }
+
+done:
+    g_rw_lock_writer_unlock (&shard->lock);
+}
+
+static void _gimo_data_store_remove (GimoDataStore *self,
+                                     GQuark key)
+{
+    struct _DataShard *shard = _gimo_data_store_shard (self, key);
+
+    g_rw_lock_writer_lock (&shard->lock);
+    _data_table_remove (&shard->table, key);
+    g_rw_lock_writer_unlock (&shard->lock);
+}
+
+/*
+ * The values are copied shard by shard, and @func is called without
+ * lock, so it may use the store.
+ */
+static gboolean _gimo_data_store_foreach (GimoDataStore *self,
+                                          GTraverseFunc func,
+                                          gpointer user_data)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    struct _DataItem *item;
+    GArray *items;
+    gboolean result = FALSE;
+    guint i, j;
+
+    items = g_array_new (FALSE, TRUE, sizeof (struct _DataItem));
+
+    for (i = 0; i < DATA_SHARD_COUNT; ++i) {
+        shard = &self->priv->shards[i];
+
+        g_rw_lock_reader_lock (&shard->lock);
+
+        for (j = 0; j < shard->table.size; ++j) {
+            e = &shard->table.entries[j];
+
+            if (0 == e->key || DATA_TOMBSTONE == e->key)
+                continue;
+
+            g_array_set_size (items, items->len + 1);
+            item = &g_array_index (items, struct _DataItem, items->len - 1);
+            item->key = e->key;
+            g_value_init (&item->value, G_VALUE_TYPE (&e->value));
+            g_value_copy (&e->value, &item->value);
+        }
+
+        g_rw_lock_reader_unlock (&shard->lock);
+    }
+
+    for (i = 0; i < items->len && !result; ++i) {
+        item = &g_array_index (items, struct _DataItem, i);
+        result = func ((gpointer) g_quark_to_string (item->key),
+                       &item->value,
+                       user_data);
+    }
+
+    for (i = 0; i < items->len; ++i)
+        g_value_unset (&g_array_index (items, struct _DataItem, i).value);
+
+    g_array_unref (items);
+
+    return result;
+}
+
+static gboolean _gimo_data_value_get_int64 (const GValue *value,
+                                            gint64 *result)
+{
+    switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+    case G_TYPE_INT:
+        *result = g_value_get_int (value);
+        return TRUE;
+
+    case G_TYPE_UINT:
+        *result = g_value_get_uint (value);
+        return TRUE;
+
+    case G_TYPE_LONG:
+        *result = g_value_get_long (value);
+        return TRUE;
+
+    case G_TYPE_ULONG:
+        *result = (gint64) g_value_get_ulong (value);
+        return TRUE;
+
+    case G_TYPE_INT64:
+        *result = g_value_get_int64 (value);
+        return TRUE;
+
+    case G_TYPE_UINT64:
+        *result = (gint64) g_value_get_uint64 (value);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* The value keeps its type, it's truncated as a C cast does. */
+static void _gimo_data_value_set_int64 (GValue *value,
+                                        gint64 v)
+{
+    switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+    case G_TYPE_INT:
+        g_value_set_int (value, (gint) v);
+        break;
+
+    case G_TYPE_UINT:
+        g_value_set_uint (value, (guint) v);
+        break;
+
+    case G_TYPE_LONG:
+        g_value_set_long (value, (glong) v);
+        break;
+
+    case G_TYPE_ULONG:
+        g_value_set_ulong (value, (gulong) v);
+        break;
+
+    case G_TYPE_INT64:
+        g_value_set_int64 (value, v);
+        break;
+
+    case G_TYPE_UINT64:
+        g_value_set_uint64 (value, (guint64) v);
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+}
+
 static void gimo_data_store_init (GimoDataStore *self)
 {
     GimoDataStorePrivate *priv;
+    guint i;
 
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
                                               GIMO_TYPE_DATASTORE,
                                               GimoDataStorePrivate);
     priv = self->priv;
 
-    priv->datas = g_tree_new_full (_gimo_gtree_string_compare,
-                                   NULL, NULL,
-                                   _gimo_data_value_destroy);
+    for (i = 0; i < DATA_SHARD_COUNT; ++i) {
+        priv->shards[i].table.entries = NULL;
+        priv->shards[i].table.size = 0;
+        priv->shards[i].table.used = 0;
+        priv->shards[i].table.filled = 0;
+        g_rw_lock_init (&priv->shards[i].lock);
+    }
+
+    priv->backings = NULL;
+    g_mutex_init (&priv->mutex);
 }
 
 static void gimo_data_store_finalize (GObject *gobject)
 {
     GimoDataStore *self = GIMO_DATASTORE (gobject);
     GimoDataStorePrivate *priv = self->priv;
+    guint i;
 
-    g_tree_unref (priv->datas);
+    for (i = 0; i < DATA_SHARD_COUNT; ++i) {
+        _data_table_clear (&priv->shards[i].table);
+        g_rw_lock_clear (&priv->shards[i].lock);
+    }
+
+    /* The strings of the values may point into them. */
+    g_slist_free_full (priv->backings, (GDestroyNotify) g_variant_unref);
+    g_mutex_clear (&priv->mutex);
 
     G_OBJECT_CLASS (gimo_data_store_parent_class)->finalize (gobject);
 }
@@ -131,30 +511,17 @@ void gimo_data_store_set (GimoDataStore *self,
                           const gchar *key,
                           const GValue *value)
 {
-    GimoDataStorePrivate *priv;
-
     g_return_if_fail (GIMO_IS_DATASTORE (self));
-
-    priv = self->priv;
+    g_return_if_fail (key != NULL);
 
     if (value) {
-        GValue *v;
-        gchar *k;
-        gsize size;
-
-        size = sizeof (GValue) + strlen (key) + 1;
-        v = g_malloc (size);
-        memset (v, 0, size);
-
-        k = (gchar *)v + sizeof (GValue);
-        g_value_init (v, G_VALUE_TYPE (value));
-        g_value_copy (value, v);
-        strcpy (k, key);
-
-        g_tree_replace (priv->datas, k, v);
+        gimo_data_store_set_quark (self, g_quark_from_string (key), value);
     }
     else {
-        g_tree_remove (priv->datas, key);
+        GQuark quark = g_quark_try_string (key);
+
+        if (quark)
+            gimo_data_store_set_quark (self, quark, NULL);
     }
 }
 
@@ -163,7 +530,14 @@ void gimo_data_store_set (GimoDataStore *self,
  * @self: a #GimoDataStore
  * @key: the data key
  *
- * Retrieve a data from the data store.
+ * Retrieve a data from the data store. The value is borrowed from
+ * the store, it's only valid while no other thread modifies the
+ * store, use gimo_data_store_get_value() otherwise.
+ *
+ * Unlike the former tree of values, where a value stayed in place
+ * until its own key was changed, an insert of any key of the same
+ * shard may resize the table and move the value. So the returned
+ * value is also invalid after the caller itself sets another key.
  *
  * Returns: (allow-none) (transfer none): a #GValue containing
  *          the value stored in the given key, or %NULL on error.
@@ -171,13 +545,217 @@ void gimo_data_store_set (GimoDataStore *self,
 const GValue* gimo_data_store_get (GimoDataStore *self,
                                    const gchar *key)
 {
-    GimoDataStorePrivate *priv;
+    GQuark quark;
 
     g_return_val_if_fail (GIMO_IS_DATASTORE (self), NULL);
 
-    priv = self->priv;
+    /* A key never interned is never stored. */
+    quark = g_quark_try_string (key);
+    if (0 == quark)
+        return NULL;
+
+    return gimo_data_store_get_quark (self, quark);
+}
+
+/**
+ * gimo_data_store_set_quark:
+ * @self: a #GimoDataStore
+ * @key: the data key
+ * @value: (allow-none): the data value
+ *
+ * Store a data to the data store, a value of the same type is
+ * overwritten in place.
+ */
+void gimo_data_store_set_quark (GimoDataStore *self,
+                                GQuark key,
+                                const GValue *value)
+{
+    g_return_if_fail (GIMO_IS_DATASTORE (self));
+    g_return_if_fail (key != 0);
+
+    if (value)
+        _gimo_data_store_insert (self, key, value, TRUE);
+    else
+        _gimo_data_store_remove (self, key);
+}
+
+/**
+ * gimo_data_store_get_quark:
+ * @self: a #GimoDataStore
+ * @key: the data key
+ *
+ * Retrieve a data from the data store by quark. The value is
+ * borrowed as by gimo_data_store_get(), use it only while no other
+ * thread modifies the store.
+ *
+ * Returns: (allow-none) (transfer none): a #GValue containing
+ *          the value stored in the given key, or %NULL on error.
+ */
+const GValue* gimo_data_store_get_quark (GimoDataStore *self,
+                                         GQuark key)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), NULL);
+    g_return_val_if_fail (key != 0, NULL);
+
+    shard = _gimo_data_store_shard (self, key);
+
+    g_rw_lock_reader_lock (&shard->lock);
+    e = _data_table_lookup (&shard->table, key);
+    g_rw_lock_reader_unlock (&shard->lock);
+
+    if (e)
+        return &e->value;
+
+    return NULL;
+}
+
+/**
+ * gimo_data_store_get_value:
+ * @self: a #GimoDataStore
+ * @key: the data key
+ * @value: (out caller-allocates): an uninitialized #GValue
+ *
+ * Copy a data of the data store, it's safe while other threads
+ * modify the store.
+ *
+ * Returns: whether the key is found and @value is initialized
+ */
+gboolean gimo_data_store_get_value (GimoDataStore *self,
+                                    const gchar *key,
+                                    GValue *value)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    GQuark quark;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), FALSE);
+    g_return_val_if_fail (value != NULL, FALSE);
+
+    quark = g_quark_try_string (key);
+    if (0 == quark)
+        return FALSE;
+
+    shard = _gimo_data_store_shard (self, quark);
 
-    return g_tree_lookup (priv->datas, key);
+    g_rw_lock_reader_lock (&shard->lock);
+
+    e = _data_table_lookup (&shard->table, quark);
+    if (e) {
+        g_value_init (value, G_VALUE_TYPE (&e->value));
+        g_value_copy (&e->value, value);
+    }
+
+    g_rw_lock_reader_unlock (&shard->lock);
+
+    return e != NULL;
+}
+
+/**
+ * gimo_data_store_increment:
+ * @self: a #GimoDataStore
+ * @key: the data key
+ * @delta: the value to add
+ *
+ * Add to an integer data atomically. A missing data is created as
+ * a #gint64 of @delta, an existing one keeps its integer type.
+ *
+ * Returns: the new value, or 0 if the data is not an integer
+ */
+gint64 gimo_data_store_increment (GimoDataStore *self,
+                                  const gchar *key,
+                                  gint64 delta)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    GQuark quark;
+    gint64 result = 0;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), 0);
+    g_return_val_if_fail (key != NULL, 0);
+
+    quark = g_quark_from_string (key);
+    shard = _gimo_data_store_shard (self, quark);
+
+    g_rw_lock_writer_lock (&shard->lock);
+
+    e = _data_table_insert (&shard->table, quark);
+
+    if (!G_IS_VALUE (&e->value)) {
+        g_value_init (&e->value, G_TYPE_INT64);
+        g_value_set_int64 (&e->value, delta);
+        result = delta;
+    }
+    else if (_gimo_data_value_get_int64 (&e->value, &result)) {
+        _gimo_data_value_set_int64 (&e->value, result + delta);
+        _gimo_data_value_get_int64 (&e->value, &result);
+    }
+    else {
+        gimo_set_error_full (GIMO_ERROR_INVALID_TYPE,
+                             "DataStore not integer: %s: %s",
+                             key, G_VALUE_TYPE_NAME (&e->value));
+        result = 0;
+    }
+
+    g_rw_lock_writer_unlock (&shard->lock);
+
+    return result;
+}
+
+/**
+ * gimo_data_store_compare_and_set_int64:
+ * @self: a #GimoDataStore
+ * @key: the data key
+ * @old_value: the expected value
+ * @new_value: the value to set
+ *
+ * Set an integer data to @new_value atomically, if it's currently
+ * @old_value. A missing data compares equal to 0, and is created as
+ * a #gint64.
+ *
+ * Returns: whether the data is set
+ */
+gboolean gimo_data_store_compare_and_set_int64 (GimoDataStore *self,
+                                                const gchar *key,
+                                                gint64 old_value,
+                                                gint64 new_value)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    GQuark quark;
+    gint64 current;
+    gboolean result = FALSE;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), FALSE);
+    g_return_val_if_fail (key != NULL, FALSE);
+
+    quark = g_quark_from_string (key);
+    shard = _gimo_data_store_shard (self, quark);
+
+    g_rw_lock_writer_lock (&shard->lock);
+
+    e = _data_table_lookup (&shard->table, quark);
+
+    if (NULL == e) {
+        if (0 == old_value) {
+            e = _data_table_insert (&shard->table, quark);
+            g_value_init (&e->value, G_TYPE_INT64);
+            g_value_set_int64 (&e->value, new_value);
+            result = TRUE;
+        }
+    }
+    else if (_gimo_data_value_get_int64 (&e->value, &current)) {
+        if (current == old_value) {
+            _gimo_data_value_set_int64 (&e->value, new_value);
+            result = TRUE;
+        }
+    }
+
+    g_rw_lock_writer_unlock (&shard->lock);
+
+    return result;
 }
 
 /**
@@ -187,19 +765,17 @@ const GValue* gimo_data_store_get (GimoDataStore *self,
  *   returns %TRUE, the traversal is stopped.
  * @user_data: user data to pass to the function.
  *
- * Calls the given function for each of the key/value pairs in the store.
+ * Calls the given function for each of the key/value pairs in the
+ * store, in no particular order. The function gets copies of the
+ * values, so the store may be modified during the traversal.
  */
 void gimo_data_store_foreach (GimoDataStore *self,
                               GTraverseFunc func,
                               gpointer user_data)
 {
-    GimoDataStorePrivate *priv;
-
     g_return_if_fail (GIMO_IS_DATASTORE (self));
 
-    priv = self->priv;
-
-    g_tree_foreach (priv->datas, func, user_data);
+    _gimo_data_store_foreach (self, func, user_data);
 }
 
 /**
@@ -232,7 +808,9 @@ void gimo_data_store_set_string (GimoDataStore *self,
  * @self: a #GimoDataStore
  * @key: the string key
  *
- * Retrieve a string from the data store.
+ * Retrieve a string from the data store. The string is borrowed as
+ * by gimo_data_store_get(), use it only while no other thread
+ * modifies the store, or use gimo_data_store_dup_string().
  *
  * Returns: (allow-none) (transfer none): the string stored
  *          in the given key, or %NULL on error.
@@ -248,6 +826,44 @@ const gchar* gimo_data_store_get_string (GimoDataStore *self,
     return NULL;
 }
 
+/**
+ * gimo_data_store_dup_string:
+ * @self: a #GimoDataStore
+ * @key: the string key
+ *
+ * Copy a string of the data store, it's safe while other threads
+ * modify the store.
+ *
+ * Returns: (allow-none) (transfer full): a copy of the string stored
+ *          in the given key, or %NULL on error.
+ */
+gchar* gimo_data_store_dup_string (GimoDataStore *self,
+                                   const gchar *key)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    GQuark quark;
+    gchar *result = NULL;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), NULL);
+
+    quark = g_quark_try_string (key);
+    if (0 == quark)
+        return NULL;
+
+    shard = _gimo_data_store_shard (self, quark);
+
+    g_rw_lock_reader_lock (&shard->lock);
+
+    e = _data_table_lookup (&shard->table, quark);
+    if (e && G_VALUE_HOLDS_STRING (&e->value))
+        result = g_value_dup_string (&e->value);
+
+    g_rw_lock_reader_unlock (&shard->lock);
+
+    return result;
+}
+
 /**
  * gimo_data_store_set_object:
  * @self: a #GimoDataStore
@@ -278,7 +894,9 @@ void gimo_data_store_set_object (GimoDataStore *self,
  * @self: a #GimoDataStore
  * @key: the object key
  *
- * Retrieve an object from the data store.
+ * Retrieve an object from the data store. The object is not
+ * referenced, the store may drop it when another thread modifies
+ * the store, use gimo_data_store_dup_object() in that case.
  *
  * Returns: (allow-none) (transfer none): the object stored
  *          in the given key, or %NULL on error.
@@ -294,6 +912,374 @@ GObject* gimo_data_store_get_object (GimoDataStore *self,
     return NULL;
 }
 
+/**
+ * gimo_data_store_dup_object:
+ * @self: a #GimoDataStore
+ * @key: the object key
+ *
+ * Retrieve a reference to an object of the data store, it's safe
+ * while other threads modify the store.
+ *
+ * Returns: (allow-none) (transfer full): the object stored
+ *          in the given key, or %NULL on error.
+ */
+GObject* gimo_data_store_dup_object (GimoDataStore *self,
+                                     const gchar *key)
+{
+    struct _DataShard *shard;
+    struct _DataEntry *e;
+    GQuark quark;
+    GObject *result = NULL;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), NULL);
+
+    quark = g_quark_try_string (key);
+    if (0 == quark)
+        return NULL;
+
+    shard = _gimo_data_store_shard (self, quark);
+
+    g_rw_lock_reader_lock (&shard->lock);
+
+    e = _data_table_lookup (&shard->table, quark);
+    if (e && G_VALUE_HOLDS_OBJECT (&e->value))
+        result = g_value_dup_object (&e->value);
+
+    g_rw_lock_reader_unlock (&shard->lock);
+
+    return result;
+}
+
+static GVariant* _gimo_data_value_serialize (const GValue *value)
+{
+    GType type = G_VALUE_TYPE (value);
+
+    switch (G_TYPE_FUNDAMENTAL (type)) {
+    case G_TYPE_BOOLEAN:
+        return g_variant_new_boolean (g_value_get_boolean (value));
+
+    case G_TYPE_CHAR:
+        return g_variant_new_byte ((guchar) g_value_get_schar (value));
+
+    case G_TYPE_UCHAR:
+        return g_variant_new_byte (g_value_get_uchar (value));
+
+    case G_TYPE_INT:
+        return g_variant_new_int32 (g_value_get_int (value));
+
+    case G_TYPE_UINT:
+        return g_variant_new_uint32 (g_value_get_uint (value));
+
+    case G_TYPE_LONG:
+        return g_variant_new_int64 (g_value_get_long (value));
+
+    case G_TYPE_ULONG:
+        return g_variant_new_uint64 (g_value_get_ulong (value));
+
+    case G_TYPE_INT64:
+        return g_variant_new_int64 (g_value_get_int64 (value));
+
+    case G_TYPE_UINT64:
+        return g_variant_new_uint64 (g_value_get_uint64 (value));
+
+    case G_TYPE_ENUM:
+        return g_variant_new_int32 (g_value_get_enum (value));
+
+    case G_TYPE_FLAGS:
+        return g_variant_new_uint32 (g_value_get_flags (value));
+
+    case G_TYPE_FLOAT:
+        return g_variant_new_double (g_value_get_float (value));
+
+    case G_TYPE_DOUBLE:
+        return g_variant_new_double (g_value_get_double (value));
+
+    case G_TYPE_STRING:
+        if (g_value_get_string (value))
+            return g_variant_new_string (g_value_get_string (value));
+        break;
+
+    case G_TYPE_VARIANT:
+        if (g_value_get_variant (value))
+            return g_variant_new_variant (g_value_get_variant (value));
+        break;
+
+    case G_TYPE_OBJECT:
+        if (GIMO_IS_DATASTORE (g_value_get_object (value)))
+            return gimo_data_store_serialize (g_value_get_object (value));
+        break;
+    }
+
+    return NULL;
+}
+
+static gboolean _gimo_data_store_serialize (gpointer key,
+                                            gpointer value,
+                                            gpointer data)
+{
+    GVariant *v = _gimo_data_value_serialize (value);
+
+    if (v) {
+        g_variant_builder_add (data, "{sv}", key, v);
+    }
+    else {
+        g_warning ("DataStore can't serialize value: %s: %s",
+                   (const gchar *) key,
+                   G_VALUE_TYPE_NAME ((GValue *) value));
+    }
+
+    return FALSE;
+}
+
+static void _gimo_data_store_add_backing (GimoDataStore *self,
+                                          GVariant *backing)
+{
+    GimoDataStorePrivate *priv = self->priv;
+
+    g_mutex_lock (&priv->mutex);
+    priv->backings = g_slist_prepend (priv->backings,
+                                      g_variant_ref (backing));
+    g_mutex_unlock (&priv->mutex);
+}
+
+/*
+ * The strings are not copied, @backing keeps the data alive for
+ * the life of @self.
+ */
+static void _gimo_data_store_deserialize (GimoDataStore *self,
+                                          GVariant *variant,
+                                          GVariant *backing)
+{
+    GVariantIter iter;
+    GVariant *child;
+    const gchar *key;
+    GValue value = G_VALUE_INIT;
+
+    g_variant_iter_init (&iter, variant);
+
+    while (g_variant_iter_next (&iter, "{&sv}", &key, &child)) {
+        const GVariantType *type = g_variant_get_type (child);
+
+        if (g_variant_type_equal (type, G_VARIANT_TYPE_STRING)) {
+            g_value_init (&value, G_TYPE_STRING);
+            g_value_set_static_string (&value,
+                                       g_variant_get_string (child, NULL));
+        }
+        else if (g_variant_type_equal (type, G_VARIANT_TYPE_VARDICT)) {
+            GimoDataStore *store = gimo_data_store_new ();
+
+            _gimo_data_store_add_backing (store, backing);
+
+            _gimo_data_store_deserialize (store, child, backing);
+
+            g_value_init (&value, G_TYPE_OBJECT);
+            g_value_take_object (&value, store);
+        }
+        else if (g_variant_type_equal (type, G_VARIANT_TYPE_VARIANT)) {
+            g_value_init (&value, G_TYPE_VARIANT);
+            g_value_take_variant (&value, g_variant_get_variant (child));
+        }
+        else {
+            switch (g_variant_classify (child)) {
+            case G_VARIANT_CLASS_BOOLEAN:
+                g_value_init (&value, G_TYPE_BOOLEAN);
+                g_value_set_boolean (&value, g_variant_get_boolean (child));
+                break;
+
+            case G_VARIANT_CLASS_BYTE:
+                g_value_init (&value, G_TYPE_UCHAR);
+                g_value_set_uchar (&value, g_variant_get_byte (child));
+                break;
+
+            case G_VARIANT_CLASS_INT32:
+                g_value_init (&value, G_TYPE_INT);
+                g_value_set_int (&value, g_variant_get_int32 (child));
+                break;
+
+            case G_VARIANT_CLASS_UINT32:
+                g_value_init (&value, G_TYPE_UINT);
+                g_value_set_uint (&value, g_variant_get_uint32 (child));
+                break;
+
+            case G_VARIANT_CLASS_INT64:
+                g_value_init (&value, G_TYPE_INT64);
+                g_value_set_int64 (&value, g_variant_get_int64 (child));
+                break;
+
+            case G_VARIANT_CLASS_UINT64:
+                g_value_init (&value, G_TYPE_UINT64);
+                g_value_set_uint64 (&value, g_variant_get_uint64 (child));
+                break;
+
+            case G_VARIANT_CLASS_DOUBLE:
+                g_value_init (&value, G_TYPE_DOUBLE);
+                g_value_set_double (&value, g_variant_get_double (child));
+                break;
+
+            default:
+                /* Kept as is. */
+                g_value_init (&value, G_TYPE_VARIANT);
+                g_value_set_variant (&value, child);
+                break;
+            }
+        }
+
+        _gimo_data_store_insert (self,
+                                 g_quark_from_string (key),
+                                 &value,
+                                 FALSE);
+        memset (&value, 0, sizeof (value));
+        g_variant_unref (child);
+    }
+}
+
+/**
+ * gimo_data_store_serialize:
+ * @self: a #GimoDataStore
+ *
+ * Serialize the data store to a "a{sv}" #GVariant. The nested data
+ * stores are serialized recursively. The values are stored by their
+ * fundamental type: the integers as int32, uint32, int64 or uint64,
+ * the floats as double, the chars as byte. The values of the other
+ * types are skipped with a warning.
+ *
+ * Returns: (transfer none): a floating #GVariant
+ */
+GVariant* gimo_data_store_serialize (GimoDataStore *self)
+{
+    GVariantBuilder builder;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), NULL);
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+    _gimo_data_store_foreach (self,
+                              _gimo_data_store_serialize,
+                              &builder);
+
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * gimo_data_store_deserialize:
+ * @self: a #GimoDataStore
+ * @variant: a "a{sv}" #GVariant
+ *
+ * Add the values of a serialized data store. The strings point into
+ * @variant without copying, it's referenced by the data store.
+ *
+ * Returns: whether the data are added
+ */
+gboolean gimo_data_store_deserialize (GimoDataStore *self,
+                                      GVariant *variant)
+{
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), FALSE);
+    g_return_val_if_fail (variant != NULL, FALSE);
+
+    if (!g_variant_is_of_type (variant, G_VARIANT_TYPE_VARDICT)) {
+        gimo_set_error_full (GIMO_ERROR_INVALID_TYPE,
+                             "DataStore invalid variant type: %s",
+                             g_variant_get_type_string (variant));
+        return FALSE;
+    }
+
+    g_variant_ref_sink (variant);
+    _gimo_data_store_add_backing (self, variant);
+    _gimo_data_store_deserialize (self, variant, variant);
+    g_variant_unref (variant);
+
+    return TRUE;
+}
+
+/**
+ * gimo_data_store_save:
+ * @self: a #GimoDataStore
+ * @file_name: the file name
+ *
+ * Save the serialized data store to a file, in little endian.
+ *
+ * Returns: whether the file is written
+ */
+gboolean gimo_data_store_save (GimoDataStore *self,
+                               const gchar *file_name)
+{
+    GVariant *variant;
+    GError *error = NULL;
+    gboolean result;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), FALSE);
+
+    variant = g_variant_ref_sink (gimo_data_store_serialize (self));
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+    {
+        GVariant *swapped = g_variant_byteswap (variant);
+        g_variant_unref (variant);
+        variant = swapped;
+    }
+#endif
+
+    result = g_file_set_contents (file_name,
+                                  g_variant_get_data (variant),
+                                  g_variant_get_size (variant),
+                                  &error);
+    if (!result) {
+        gimo_set_error_full (GIMO_ERROR_OPEN_FILE,
+                             "DataStore write error: %s",
+                             error->message);
+        g_error_free (error);
+    }
+
+    g_variant_unref (variant);
+
+    return result;
+}
+
+/**
+ * gimo_data_store_read:
+ * @self: a #GimoDataStore
+ * @file_name: the file name
+ *
+ * Read a file written by gimo_data_store_save(). The file is mapped
+ * and the strings are used in place.
+ *
+ * Returns: whether the file is read
+ */
+gboolean gimo_data_store_read (GimoDataStore *self,
+                               const gchar *file_name)
+{
+    GMappedFile *file;
+    GVariant *variant;
+    gboolean result;
+
+    g_return_val_if_fail (GIMO_IS_DATASTORE (self), FALSE);
+
+    file = g_mapped_file_new (file_name, FALSE, NULL);
+    if (NULL == file)
+        gimo_set_error_return_val (GIMO_ERROR_OPEN_FILE, FALSE);
+
+    variant = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
+                                       g_mapped_file_get_contents (file),
+                                       g_mapped_file_get_length (file),
+                                       FALSE,
+                                       (GDestroyNotify) g_mapped_file_unref,
+                                       file);
+    g_variant_ref_sink (variant);
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+    {
+        GVariant *swapped = g_variant_byteswap (variant);
+        g_variant_unref (variant);
+        variant = swapped;
+    }
+#endif
+
+    result = gimo_data_store_deserialize (self, variant);
+    g_variant_unref (variant);
+
+    return result;
+}
+
 /**
  * gimo_bind:
  * @object: a #GObject
@@ -59,6 +59,26 @@ void gimo_data_store_set (GimoDataStore *self,
 const GValue* gimo_data_store_get (GimoDataStore *self,
                                    const gchar *key);
 
+void gimo_data_store_set_quark (GimoDataStore *self,
+                                GQuark key,
+                                const GValue *value);
+
+const GValue* gimo_data_store_get_quark (GimoDataStore *self,
+                                         GQuark key);
+
+gboolean gimo_data_store_get_value (GimoDataStore *self,
+                                    const gchar *key,
+                                    GValue *value);
+
+gint64 gimo_data_store_increment (GimoDataStore *self,
+                                  const gchar *key,
+                                  gint64 delta);
+
+gboolean gimo_data_store_compare_and_set_int64 (GimoDataStore *self,
+                                                const gchar *key,
+                                                gint64 old_value,
+                                                gint64 new_value);
+
 void gimo_data_store_foreach (GimoDataStore *self,
                               GTraverseFunc func,
                               gpointer user_data);
@@ -70,6 +90,9 @@ void gimo_data_store_set_string (GimoDataStore *self,
 const gchar* gimo_data_store_get_string (GimoDataStore *self,
                                          const gchar *key);
 
+gchar* gimo_data_store_dup_string (GimoDataStore *self,
+                                   const gchar *key);
+
 void gimo_data_store_set_object (GimoDataStore *self,
                                  const gchar *key,
                                  GObject *value);
@@ -77,6 +100,20 @@ void gimo_data_store_set_object (GimoDataStore *self,
 GObject* gimo_data_store_get_object (GimoDataStore *self,
                                      const gchar *key);
 
+GObject* gimo_data_store_dup_object (GimoDataStore *self,
+                                     const gchar *key);
+
+GVariant* gimo_data_store_serialize (GimoDataStore *self);
+
+gboolean gimo_data_store_deserialize (GimoDataStore *self,
+                                      GVariant *variant);
+
+gboolean gimo_data_store_save (GimoDataStore *self,
+                               const gchar *file_name);
+
+gboolean gimo_data_store_read (GimoDataStore *self,
+                               const gchar *file_name);
+
 void gimo_bind (GObject *object,
                 const gchar *key,
                 const GValue *value);
@@ -17,13 +17,56 @@
  * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
  * Boston, MA 02111-1307, USA.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "config.h"
 #include "gimo-dlmodule.h"
 #include "gimo-error.h"
+#include "gimo-utils.h"
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+/*
+ * MT safe
+ *
+ * A module is unmapped only when it's closed and no object it created
+ * is alive. A module registering static types, or leaving callbacks
+ * in objects it doesn't create, must make itself resident with
+ * g_module_make_resident () in g_module_check_init (), as GModule
+ * expects.
+ */
 
 struct _GimoDlmodulePrivate {
     GModule *module;
+    GHashTable *symbols;
+    GimoModuleFlags flags;
+    gint64 open_time;
+    const GimoModuleDescriptor *descriptor;
+    gint live_objects;
+    gboolean resident;
+    gboolean close_pending;
+    GMutex mutex;
 };
 
+/* Modules whose handed out objects have been finalized, one entry
+ * per object, see _gimo_dlmodule_object_finalized (). */
+static GSList *dead_modules;
+static gboolean collect_scheduled;
+
+static GQuark owners_quark;
+
+/* ISO C has no cast between function and data pointers. */
+union _SymbolAddress {
+    GimoModuleFunc func;
+    gpointer address;
+};
+
+G_LOCK_DEFINE_STATIC (dlmodule_lock);
+
 static void gimo_loadable_interface_init (GimoLoadableInterface *iface);
 static void gimo_module_interface_init (GimoModuleInterface *iface);
 
@@ -33,16 +76,240 @@ G_DEFINE_TYPE_WITH_CODE (GimoDlmodule, gimo_dlmodule, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (GIMO_TYPE_MODULE,
                                                 gimo_module_interface_init))
 
+/*
+ * Lookup the address of a symbol, the found and missing symbols
+ * are both cached to avoid repeated dlsym. Must be called with
+ * the mutex held.
+ */
+static gboolean _gimo_dlmodule_lookup (GimoDlmodule *self,
+                                       const gchar *symbol,
+                                       gpointer *address)
+{
+    GimoDlmodulePrivate *priv = self->priv;
+
+    if (g_hash_table_lookup_extended (priv->symbols,
+                                      symbol,
+                                      NULL,
+                                      address))
+    {
+        return *address != NULL;
+    }
+
+    if (!g_module_symbol (priv->module, symbol, address))
+        *address = NULL;
+
+    g_hash_table_insert (priv->symbols, g_strdup (symbol), *address);
+
+    return *address != NULL;
+}
+
+static gboolean _gimo_dlmodule_collect_idle (gpointer data)
+{
+    G_LOCK (dlmodule_lock);
+    collect_scheduled = FALSE;
+    G_UNLOCK (dlmodule_lock);
+
+    _gimo_dlmodule_collect ();
+
+    return FALSE;
+}
+
+/*
+ * Called with the modules which created an object when the object
+ * data is cleared at the end of its finalize. The object is still
+ * being freed, so the modules are only queued here, their objects
+ * are counted as dead by _gimo_dlmodule_collect (), which is run
+ * from the main loop once no module code is on the stack.
+ */
+static void _gimo_dlmodule_object_finalized (gpointer data)
+{
+    gboolean schedule;
+
+    G_LOCK (dlmodule_lock);
+    dead_modules = g_slist_concat (data, dead_modules);
+    schedule = !collect_scheduled;
+    collect_scheduled = TRUE;
+    G_UNLOCK (dlmodule_lock);
+
+    if (schedule)
+        g_idle_add (_gimo_dlmodule_collect_idle, NULL);
+}
+
+#ifdef HAVE_DLADDR
+/*
+ * Check whether the class of the object refers to code of the module,
+ * which can't be unmapped while the type exists.
+ */
+static gboolean _gimo_dlmodule_owns_class (GObject *object,
+                                           gconstpointer address)
+{
+    GTypeQuery query;
+    gpointer *slots;
+    Dl_info info;
+    gpointer base;
+    guint i;
+
+    if (!dladdr (address, &info))
+        return FALSE;
+
+    base = info.dli_fbase;
+
+    g_type_query (G_OBJECT_TYPE (object), &query);
+    slots = (gpointer *) G_OBJECT_GET_CLASS (object);
+
+    for (i = sizeof (GTypeClass) / sizeof (gpointer);
+         i < query.class_size / sizeof (gpointer); ++i)
+    {
+        if (slots[i] && dladdr (slots[i], &info) &&
+            info.dli_fbase == base)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+#endif
+
+/*
+ * Track an object created by the module, the module is kept mapped
+ * until the object dies.
+ */
+static void _gimo_dlmodule_track (GimoDlmodule *self,
+                                  GObject *object,
+                                  GimoModuleFunc func)
+{
+    GimoDlmodulePrivate *priv = self->priv;
+    GSList *owners;
+
+#ifdef HAVE_DLADDR
+    union _SymbolAddress code;
+
+    code.func = func;
+
+    if (!priv->resident &&
+        _gimo_dlmodule_owns_class (object, code.address))
+    {
+        g_mutex_lock (&priv->mutex);
+
+        if (priv->module)
+            g_module_make_resident (priv->module);
+
+        priv->resident = TRUE;
+        g_mutex_unlock (&priv->mutex);
+    }
+#endif
+
+    g_atomic_int_add (&priv->live_objects, 1);
+
+    G_LOCK (dlmodule_lock);
+    owners = g_object_steal_qdata (object, owners_quark);
+    owners = g_slist_prepend (owners, g_object_ref (self));
+    g_object_set_qdata_full (object,
+                             owners_quark,
+                             owners,
+                             _gimo_dlmodule_object_finalized);
+    G_UNLOCK (dlmodule_lock);
+}
+
+/*
+ * Resolve the optional descriptor of the module, its symbols are put
+ * into the symbol cache so they are never looked up with dlsym.
+ */
+static void _gimo_dlmodule_load_descriptor (GimoDlmodule *self)
+{
+    GimoDlmodulePrivate *priv = self->priv;
+    GimoModuleDescriptorFunc get_descriptor = NULL;
+    const GimoModuleDescriptor *descriptor;
+    const GimoModuleSymbol *it;
+    union _SymbolAddress code;
+
+    if (!g_module_symbol (priv->module,
+                          GIMO_MODULE_DESCRIPTOR_SYMBOL,
+                          (gpointer *) &get_descriptor) ||
+        NULL == get_descriptor)
+    {
+        return;
+    }
+
+    descriptor = get_descriptor ();
+    if (NULL == descriptor)
+        return;
+
+    if (descriptor->version != GIMO_MODULE_DESCRIPTOR_VERSION) {
+        g_warning ("Dlmodule: unsupported descriptor version: %s: %u",
+                   g_module_name (priv->module),
+                   descriptor->version);
+        return;
+    }
+
+    g_mutex_lock (&priv->mutex);
+
+    priv->descriptor = descriptor;
+
+    for (it = descriptor->symbols; it && it->name; ++it) {
+        code.func = it->func;
+        g_hash_table_insert (priv->symbols,
+                             g_strdup (it->name),
+                             code.address);
+    }
+
+    /* The hooks are connected to plugin signals, the module
+     * can't know when they are disconnected. */
+    if (descriptor->start || descriptor->stop || descriptor->run) {
+        g_module_make_resident (priv->module);
+        priv->resident = TRUE;
+    }
+
+    g_mutex_unlock (&priv->mutex);
+}
+
 static gboolean _gimo_dlmodule_open (GimoModule *module,
                                      const gchar *file_name)
 {
     GimoDlmodule *self = GIMO_DLMODULE (module);
     GimoDlmodulePrivate *priv = self->priv;
 
+    GModuleFlags flags = G_MODULE_BIND_LAZY;
+    gint64 start_time;
+
+#if defined (HAVE_DLFCN_H) && defined (RTLD_DEEPBIND)
+    void *handle = NULL;
+#endif
+
     if (priv->module)
         gimo_set_error_return_val (GIMO_ERROR_CONFLICT, FALSE);
 
-    priv->module = g_module_open (file_name, G_MODULE_BIND_LAZY);
+    _gimo_dlmodule_collect ();
+
+    if (priv->flags & GIMO_MODULE_BIND_NOW)
+        flags &= ~G_MODULE_BIND_LAZY;
+
+    if (priv->flags & GIMO_MODULE_BIND_LOCAL)
+        flags |= G_MODULE_BIND_LOCAL;
+
+    start_time = g_get_monotonic_time ();
+
+#if defined (HAVE_DLFCN_H) && defined (RTLD_DEEPBIND)
+    /* GModule can't pass RTLD_DEEPBIND, map the library with it
+     * first, the following g_module_open () then shares the handle. */
+    if (file_name && (priv->flags & GIMO_MODULE_BIND_DEEP)) {
+        handle = dlopen (file_name,
+                         RTLD_DEEPBIND |
+                         ((flags & G_MODULE_BIND_LAZY) ? RTLD_LAZY : RTLD_NOW) |
+                         ((flags & G_MODULE_BIND_LOCAL) ? RTLD_LOCAL : RTLD_GLOBAL));
+    }
+#endif
+
+    priv->module = g_module_open (file_name, flags);
+
+#if defined (HAVE_DLFCN_H) && defined (RTLD_DEEPBIND)
+    if (handle)
+        dlclose (handle);
+#endif
+
+    priv->open_time = g_get_monotonic_time () - start_time;
+
     if (NULL == priv->module) {
         gimo_set_error_full (GIMO_ERROR_UNLOAD,
                              "Dlmodule: open module error: %s: %s",
@@ -51,6 +318,8 @@ static gboolean _gimo_dlmodule_open (GimoModule *module,
         return FALSE;
     }
 
+    _gimo_dlmodule_load_descriptor (self);
+
     return TRUE;
 }
 
@@ -62,11 +331,27 @@ static gboolean _gimo_dlmodule_close (GimoModule *module)
     if (NULL == priv->module)
         return TRUE;
 
-    /* NOTE: Don't close module, otherwise valgrind will
-     *       report memory leak. */
-    return FALSE;
+    _gimo_dlmodule_collect ();
+
+    /* Staying mapped is what a resident module asks for. */
+    if (priv->resident)
+        return FALSE;
+
+    /* Closed by _gimo_dlmodule_collect () when the objects die. */
+    if (g_atomic_int_get (&priv->live_objects) > 0) {
+        priv->close_pending = TRUE;
+        gimo_set_error_full (GIMO_ERROR_UNLOAD,
+                             "Dlmodule: module is in use: %s",
+                             g_module_name (priv->module));
+        return FALSE;
+    }
+
+    g_mutex_lock (&priv->mutex);
+
+    priv->close_pending = FALSE;
 
     if (!g_module_close (priv->module)) {
+        g_mutex_unlock (&priv->mutex);
         gimo_set_error_full (GIMO_ERROR_UNLOAD,
                              "Dlmodule: close module error: %s",
                              g_module_error ());
@@ -74,6 +359,10 @@ static gboolean _gimo_dlmodule_close (GimoModule *module)
     }
 
     priv->module = NULL;
+    priv->descriptor = NULL;
+    g_hash_table_remove_all (priv->symbols);
+    g_mutex_unlock (&priv->mutex);
+
     return TRUE;
 }
 
@@ -95,22 +384,78 @@ static GObject* _gimo_dlmodule_resolve (GimoModule *module,
     GimoDlmodule *self = GIMO_DLMODULE (module);
     GimoDlmodulePrivate *priv = self->priv;
     GObject* (*new_object) (GObject*) = NULL;
+    GObject *result;
 
-    if (!priv->module)
-        return NULL;
+    g_mutex_lock (&priv->mutex);
 
-    if (!g_module_symbol (priv->module,
-                          symbol,
-                          (gpointer *) &new_object))
-    {
-        gimo_set_error (GIMO_ERROR_NO_SYMBOL);
+    if (priv->module)
+        _gimo_dlmodule_lookup (self, symbol, (gpointer *) &new_object);
+
+    g_mutex_unlock (&priv->mutex);
+
+    if (NULL == new_object) {
+        gimo_set_error_full (GIMO_ERROR_NO_SYMBOL,
+                             "Dlmodule: symbol not found: %s",
+                             symbol);
         return NULL;
     }
 
-    if (NULL == new_object)
-        return NULL;
+    result = new_object (param);
+    if (result)
+        _gimo_dlmodule_track (self, result, new_object);
+
+    return result;
+}
+
+static GPtrArray* _gimo_dlmodule_resolve_many (GimoModule *module,
+                                               const gchar **symbols,
+                                               GObject *param)
+{
+    GimoDlmodule *self = GIMO_DLMODULE (module);
+    GimoDlmodulePrivate *priv = self->priv;
+    GObject* (**new_objects) (GObject*);
+    GObject* (*new_object) (GObject*);
+    GObject *object;
+    GPtrArray *result;
+    guint i, count;
+
+    count = g_strv_length ((gchar **) symbols);
+    result = g_ptr_array_new_full (count, _gimo_safe_unref);
+    g_ptr_array_set_size (result, count);
+    new_objects = g_malloc0 (count * sizeof (*new_objects));
+
+    g_mutex_lock (&priv->mutex);
+
+    if (priv->module) {
+        for (i = 0; i < count; ++i) {
+            _gimo_dlmodule_lookup (self,
+                                   symbols[i],
+                                   (gpointer *) &new_objects[i]);
+        }
+    }
 
-    return new_object (param);
+    g_mutex_unlock (&priv->mutex);
+
+    for (i = 0; i < count; ++i) {
+        new_object = new_objects[i];
+
+        if (new_object) {
+            object = new_object (param);
+            g_ptr_array_index (result, i) = object;
+
+            if (object)
+                _gimo_dlmodule_track (self, object, new_object);
+        }
+        else {
+            gimo_set_error_full (GIMO_ERROR_NO_SYMBOL,
+                                 "Dlmodule: symbol not found: %s",
+                                 symbols[i]);
+        }
+    }
+
+    g_free (new_objects);
+
+    return result;
 }
 
 static void gimo_loadable_interface_init (GimoLoadableInterface *iface)
@@ -125,6 +470,7 @@ static void gimo_module_interface_init (GimoModuleInterface *iface)
     iface->close = _gimo_dlmodule_close;
     iface->get_name = _gimo_dlmodule_get_name;
     iface->resolve = _gimo_dlmodule_resolve;
+    iface->resolve_many = _gimo_dlmodule_resolve_many;
 }
 
 static void gimo_dlmodule_init (GimoDlmodule *self)
@@ -137,12 +483,29 @@ static void gimo_dlmodule_init (GimoDlmodule *self)
     priv = self->priv;
 
     priv->module = NULL;
+    priv->flags = 0;
+    priv->open_time = 0;
+    priv->descriptor = NULL;
+    priv->live_objects = 0;
+    priv->resident = FALSE;
+    priv->close_pending = FALSE;
+    priv->symbols = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           g_free,
+                                           NULL);
+    g_mutex_init (&priv->mutex);
 }
 
 static void gimo_dlmodule_finalize (GObject *gobject)
 {
+    GimoDlmodule *self = GIMO_DLMODULE (gobject);
+    GimoDlmodulePrivate *priv = self->priv;
+
     _gimo_dlmodule_close (GIMO_MODULE (gobject));
 
+    g_hash_table_unref (priv->symbols);
+    g_mutex_clear (&priv->mutex);
+
     G_OBJECT_CLASS (gimo_dlmodule_parent_class)->finalize (gobject);
 }
 
@@ -152,6 +515,8 @@ static void gimo_dlmodule_class_init (GimoDlmoduleClass *klass)
 
     gobject_class->finalize = gimo_dlmodule_finalize;
 
+    owners_quark = g_quark_from_static_string ("gimo-dlmodule-owners");
+
     g_type_class_add_private (gobject_class,
                               sizeof (GimoDlmodulePrivate));
 }
@@ -161,9 +526,111 @@ GimoDlmodule* gimo_dlmodule_new (void)
     return g_object_new (GIMO_TYPE_DLMODULE, NULL);
 }
 
+/*
+ * The symbols looked up from the raw handle can't be tracked, so the
+ * module is made resident once the handle is handed out.
+ */
 GModule* _gimo_dlmodule_get_gmodule (GimoDlmodule *self)
+{
+    GimoDlmodulePrivate *priv;
+
+    g_return_val_if_fail (GIMO_IS_DLMODULE (self), NULL);
+
+    priv = self->priv;
+
+    g_mutex_lock (&priv->mutex);
+
+    if (priv->module) {
+        g_module_make_resident (priv->module);
+        priv->resident = TRUE;
+    }
+
+    g_mutex_unlock (&priv->mutex);
+
+    return priv->module;
+}
+
+/*
+ * Count the queued objects as dead and release their modules, so
+ * the modules can be unmapped. A module closed while its objects
+ * were alive is closed when the last one is counted. Call it only
+ * where no code of a module is on the stack, it's also run from an
+ * idle source of the default main context.
+ */
+void _gimo_dlmodule_collect (void)
+{
+    GimoDlmodule *module;
+    GSList *list, *it;
+
+    G_LOCK (dlmodule_lock);
+    list = dead_modules;
+    dead_modules = NULL;
+    G_UNLOCK (dlmodule_lock);
+
+    for (it = list; it; it = it->next) {
+        module = it->data;
+
+        if (g_atomic_int_dec_and_test (&module->priv->live_objects) &&
+            module->priv->close_pending)
+        {
+            _gimo_dlmodule_close (GIMO_MODULE (module));
+        }
+    }
+
+    g_slist_free_full (list, g_object_unref);
+}
+
+/**
+ * gimo_dlmodule_set_flags:
+ * @self: a #GimoDlmodule
+ * @flags: the binding flags
+ *
+ * Set the binding policy used when the module is opened, it has
+ * no effect on an opened module.
+ */
+void gimo_dlmodule_set_flags (GimoDlmodule *self,
+                              GimoModuleFlags flags)
+{
+    g_return_if_fail (GIMO_IS_DLMODULE (self));
+
+    self->priv->flags = flags;
+}
+
+GimoModuleFlags gimo_dlmodule_get_flags (GimoDlmodule *self)
+{
+    g_return_val_if_fail (GIMO_IS_DLMODULE (self), 0);
+
+    return self->priv->flags;
+}
+
+/**
+ * gimo_dlmodule_get_open_time:
+ * @self: a #GimoDlmodule
+ *
+ * Get the time spent mapping and binding the module when it was
+ * opened.
+ *
+ * Returns: the open time in microseconds.
+ */
+gint64 gimo_dlmodule_get_open_time (GimoDlmodule *self)
+{
+    g_return_val_if_fail (GIMO_IS_DLMODULE (self), 0);
+
+    return self->priv->open_time;
+}
+
+/**
+ * gimo_dlmodule_get_descriptor:
+ * @self: a #GimoDlmodule
+ *
+ * Get the descriptor exported by the module as
+ * %GIMO_MODULE_DESCRIPTOR_SYMBOL.
+ *
+ * Returns: (allow-none) (transfer none): the descriptor or %NULL
+ */
+const GimoModuleDescriptor* gimo_dlmodule_get_descriptor (GimoDlmodule *self)
 {
     g_return_val_if_fail (GIMO_IS_DLMODULE (self), NULL);
 
-    return self->priv->module;
+    return self->priv->descriptor;
 }
@@ -38,6 +38,33 @@ G_BEGIN_DECLS
 #define GIMO_DLMODULE_GET_CLASS(obj) \
     (G_TYPE_INSTANCE_GET_CLASS((obj), GIMO_TYPE_DLMODULE, GimoDlmoduleClass))
 
+#define GIMO_MODULE_DESCRIPTOR_VERSION 1
+#define GIMO_MODULE_DESCRIPTOR_SYMBOL "gimo_module_descriptor"
+
+typedef struct _GimoModuleDescriptor GimoModuleDescriptor;
+
+typedef const GimoModuleDescriptor* (*GimoModuleDescriptorFunc) (void);
+
+/**
+ * GimoModuleDescriptor:
+ * @version: must be %GIMO_MODULE_DESCRIPTOR_VERSION
+ * @start: (allow-none): connected to the plugin "start" signal
+ * @stop: (allow-none): connected to the plugin "stop" signal
+ * @run: (allow-none): connected to the plugin "run" signal
+ * @symbols: (allow-none): the symbols served without dlsym,
+ *           terminated by a %NULL name
+ *
+ * The entry points of a module, returned by the function exported
+ * as %GIMO_MODULE_DESCRIPTOR_SYMBOL.
+ */
+struct _GimoModuleDescriptor {
+    guint version;
+    gboolean (*start) (GimoPlugin *plugin);
+    void (*stop) (GimoPlugin *plugin);
+    void (*run) (GimoPlugin *plugin);
+    const GimoModuleSymbol *symbols;
+};
+
 typedef struct _GimoDlmodule GimoDlmodule;
 typedef struct _GimoDlmodulePrivate GimoDlmodulePrivate;
 typedef struct _GimoDlmoduleClass GimoDlmoduleClass;
@@ -55,8 +82,19 @@ GType gimo_dlmodule_get_type (void) G_GNUC_CONST;
 
 GimoDlmodule* gimo_dlmodule_new (void);
 
+void gimo_dlmodule_set_flags (GimoDlmodule *self,
+                              GimoModuleFlags flags);
+
+GimoModuleFlags gimo_dlmodule_get_flags (GimoDlmodule *self);
+
+gint64 gimo_dlmodule_get_open_time (GimoDlmodule *self);
+
+const GimoModuleDescriptor* gimo_dlmodule_get_descriptor (GimoDlmodule *self);
+
 GModule* _gimo_dlmodule_get_gmodule (GimoDlmodule *self);
 
+void _gimo_dlmodule_collect (void);
+
 G_END_DECLS
 
 #endif /* __GIMO_DLMODULE_H__ */
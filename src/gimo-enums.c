@@ -40,3 +40,23 @@ GType gimo_plugin_state_get_type (void)
 
     return g_define_type_id__volatile;
 }
+
+GType gimo_module_flags_get_type (void)
+{
+    static volatile gsize g_define_type_id__volatile = 0;
+
+    if (g_once_init_enter (&g_define_type_id__volatile)) {
+        static const GFlagsValue values[] = {
+            { GIMO_MODULE_BIND_LAZY, "GIMO_MODULE_BIND_LAZY", "LAZY" },
+            { GIMO_MODULE_BIND_NOW, "GIMO_MODULE_BIND_NOW", "NOW" },
+            { GIMO_MODULE_BIND_LOCAL, "GIMO_MODULE_BIND_LOCAL", "LOCAL" },
+            { GIMO_MODULE_BIND_DEEP, "GIMO_MODULE_BIND_DEEP", "DEEP" },
+            { 0, NULL, NULL }
+        };
+        GType g_define_type_id =
+                g_flags_register_static (g_intern_static_string ("GimoModuleFlags"), values);
+        g_once_init_leave (&g_define_type_id__volatile, g_define_type_id);
+    }
+
+    return g_define_type_id__volatile;
+}
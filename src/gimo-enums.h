@@ -45,6 +45,27 @@ typedef enum {
 GType gimo_plugin_state_get_type (void) G_GNUC_CONST;
 #define GIMO_TYPE_PLUGIN_STATE (gimo_plugin_state_get_type ())
 
+/**
+ * GimoModuleFlags:
+ * @GIMO_MODULE_BIND_LAZY: resolve symbols on first use
+ * @GIMO_MODULE_BIND_NOW: resolve all symbols when opened
+ * @GIMO_MODULE_BIND_LOCAL: don't add symbols to the global namespace
+ * @GIMO_MODULE_BIND_DEEP: prefer the own symbols of the module over
+ *                         the global ones, where supported
+ *
+ * Binding policy of a dynamic module, no flags means lazy global
+ * binding.
+ */
+typedef enum {
+    GIMO_MODULE_BIND_LAZY = 1 << 0,
+    GIMO_MODULE_BIND_NOW = 1 << 1,
+    GIMO_MODULE_BIND_LOCAL = 1 << 2,
+    GIMO_MODULE_BIND_DEEP = 1 << 3
+} GimoModuleFlags;
+
+GType gimo_module_flags_get_type (void) G_GNUC_CONST;
+#define GIMO_TYPE_MODULE_FLAGS (gimo_module_flags_get_type ())
+
 G_END_DECLS
 
 #endif /* __GIMO_ENUMS_H__ */
@@ -21,11 +21,40 @@
 #include "gimo-error.h"
 #include "gimo-intl.h"
 
+/*
+ * The error is kept per thread, so the concurrent loads each get
+ * their own error, like errno.
+ */
+struct _ErrorState {
+    gint code;
+    gchar *message;
+};
+
+static void _gimo_error_state_free (gpointer p);
+
 static gboolean trace_error;
-static gint error_code;
-static gchar *error_message;
+static GPrivate error_state = G_PRIVATE_INIT (_gimo_error_state_free);
+
+static void _gimo_error_state_free (gpointer p)
+{
+    struct _ErrorState *state = p;
+
+    g_free (state->message);
+    g_free (state);
+}
+
+static struct _ErrorState* _gimo_error_state (gboolean create)
+{
+    struct _ErrorState *state;
+
+    state = g_private_get (&error_state);
+    if (NULL == state && create) {
+        state = g_malloc0 (sizeof *state);
+        g_private_set (&error_state, state);
+    }
 
-G_LOCK_DEFINE_STATIC (error_lock);
+    return state;
+}
 
 void gimo_trace_error (gboolean trace)
 {
@@ -42,62 +71,57 @@ void gimo_set_error_string (gint code, const gchar *string)
     gimo_set_error_full (code, string);
 }
 
+/* A code without message drops the message of the last error. */
 void gimo_set_error_full (gint code, const gchar *format, ...)
 {
-    error_code = code;
+    struct _ErrorState *state = _gimo_error_state (TRUE);
+
+    state->code = code;
+    g_free (state->message);
+    state->message = NULL;
 
     if (format) {
         va_list ap;
 
         va_start (ap, format);
-        G_LOCK (error_lock);
-
-        g_free (error_message);
-        error_message = g_strdup_vprintf (format, ap);
+        state->message = g_strdup_vprintf (format, ap);
+        va_end (ap);
 
         if (trace_error)
-            g_warning ("GimoError: %d: %s", error_code, error_message);
-
-        G_UNLOCK (error_lock);
-        va_end (ap);
+            g_warning ("GimoError: %d: %s", code, state->message);
     }
     else if (trace_error) {
         g_warning ("GimoError: %d: %s",
-                   error_code,
-                   gimo_error_to_string (error_code));
+                   code,
+                   gimo_error_to_string (code));
     }
 }
 
 gint gimo_get_error (void)
 {
-    return error_code;
+    struct _ErrorState *state = _gimo_error_state (FALSE);
+
+    return state ? state->code : 0;
 }
 
 gchar* gimo_dup_error_string (void)
 {
-    gchar *str = NULL;
+    struct _ErrorState *state = _gimo_error_state (FALSE);
 
-    if (error_message) {
-        G_LOCK (error_lock);
-        str = g_strdup (error_message);
-        G_UNLOCK (error_lock);
-    }
-    else {
-        str = g_strdup (gimo_error_to_string (error_code));
-    }
+    if (state && state->message)
+        return g_strdup (state->message);
 
-    return str;
+    return g_strdup (gimo_error_to_string (state ? state->code : 0));
 }
 
 void gimo_clear_error (void)
 {
-    error_code = 0;
+    struct _ErrorState *state = _gimo_error_state (FALSE);
 
-    if (error_message) {
-        G_LOCK (error_lock);
-        g_free (error_message);
-        error_message = NULL;
-        G_UNLOCK (error_lock);
+    if (state) {
+        state->code = 0;
+        g_free (state->message);
+        state->message = NULL;
     }
 }
 
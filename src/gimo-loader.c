@@ -17,27 +17,59 @@
  * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
  * Boston, MA 02111-1307, USA.
  */
+#include "config.h"
 #include "gimo-loader.h"
 #include "gimo-dlmodule.h"
 #include "gimo-error.h"
 #include "gimo-factory.h"
 #include "gimo-loadable.h"
 #include "gimo-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define GIMO_LOADER_MAX_THREADS 8
+
 G_DEFINE_TYPE (GimoLoader, gimo_loader, G_TYPE_OBJECT)
 
 enum {
     PROP_0,
-    PROP_CACHE
+    PROP_CACHE,
+    PROP_CAPACITY
 };
 
 struct _GimoLoaderPrivate {
     GQueue *paths;
     GQueue *loaders;
     GTree *object_tree;
-    GSList *object_list;
+    GQueue *object_queue;
+    guint capacity;
+    guint hits;
+    guint misses;
+    guint evictions;
+    GTree *pending_tree;
+    GThreadPool *prefetch_pool;
     GMutex mutex;
+    GCond cond;
+};
+
+struct _CacheEntry {
+    gchar *key;
+    GimoLoadable *object;
+};
+
+/* A load in flight, shared by all the threads loading the same file. */
+struct _PendingLoad {
+    gchar *key;
+    GThread *owner;
+    GimoLoadable *result;
+    gboolean done;
+    gint ref_count;
 };
 
 struct _FactoryInfo {
@@ -85,6 +117,66 @@ static void _path_info_unref (gpointer p)
     }
 }
 
+static struct _CacheEntry* _cache_entry_new (const gchar *key,
+                                             GimoLoadable *object)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_malloc (sizeof *entry);
+    entry->key = g_strdup (key);
+    entry->object = g_object_ref (object);
+
+    return entry;
+}
+
+/*
+ * Whether the cache is the only owner of the object. Decided when
+ * the cache is trimmed, with the mutex held no one else can take a
+ * reference from the cache, and a toggle reference would stop
+ * notifying once a language binding adds its own.
+ */
+static gboolean _cache_entry_idle (struct _CacheEntry *entry)
+{
+    GObject *object = G_OBJECT (entry->object);
+
+    return 1 == g_atomic_int_get ((gint *) &object->ref_count);
+}
+
+static void _cache_entry_free (gpointer p)
+{
+    struct _CacheEntry *entry = p;
+
+    g_object_unref (entry->object);
+    g_free (entry->key);
+    g_free (entry);
+}
+
+struct _AsyncLoad {
+    gchar *file_name;
+    GimoLoadable *result;
+    gint error_code;
+    gchar *error_string;
+};
+
+struct _BatchLoad {
+    GimoLoader *loader;
+    GPtrArray *file_names;
+    GPtrArray *results;
+    GPtrArray *errors;
+};
+
+/* Must be called with the mutex held. */
+static void _pending_load_unref (struct _PendingLoad *pending)
+{
+    if (--pending->ref_count == 0) {
+        if (pending->result)
+            g_object_unref (pending->result);
+
+        g_free (pending->key);
+        g_free (pending);
+    }
+}
+
 static GList* _gimo_loader_lookup (GimoLoader *self,
                                    const gchar *suffix)
 {
@@ -110,32 +202,97 @@ static GList* _gimo_loader_lookup (GimoLoader *self,
     return NULL;
 }
 
-static gboolean _gimo_loader_query_cached (gpointer key,
-                                           gpointer value,
-                                           gpointer data)
+static void _gimo_loader_query_cached (gpointer data,
+                                       gpointer user_data)
+{
+    struct _CacheEntry *entry = data;
+
+    g_ptr_array_add (user_data, g_object_ref (entry->object));
+}
+
+/*
+ * Lookup a cached object and move it to the head of the LRU queue,
+ * must be called with the mutex held.
+ */
+static GimoLoadable* _gimo_loader_cache_lookup (GimoLoader *self,
+                                                const gchar *key)
 {
-    GPtrArray *param = data;
+    GimoLoaderPrivate *priv = self->priv;
+    GList *link;
 
-    g_ptr_array_add (param, g_object_ref (value));
+    link = g_tree_lookup (priv->object_tree, key);
+    if (NULL == link) {
+        ++priv->misses;
+        return NULL;
+    }
 
-    return FALSE;
+    if (link != g_queue_peek_head_link (priv->object_queue)) {
+        g_queue_unlink (priv->object_queue, link);
+        g_queue_push_head_link (priv->object_queue, link);
+    }
+
+    ++priv->hits;
+
+    return ((struct _CacheEntry *) link->data)->object;
+}
+
+/*
+ * Evict the least recently used objects until the cache fits in
+ * the capacity, objects still referenced outside the cache are
+ * skipped. Must be called with the mutex held, the evicted entries
+ * are returned to be freed after the mutex is released.
+ */
+static GSList* _gimo_loader_cache_trim (GimoLoader *self)
+{
+    GimoLoaderPrivate *priv = self->priv;
+    struct _CacheEntry *entry;
+    GSList *evicted = NULL;
+    GList *link, *prev;
+
+    if (0 == priv->capacity)
+        return NULL;
+
+    link = g_queue_peek_tail_link (priv->object_queue);
+    while (link && g_queue_get_length (priv->object_queue) > priv->capacity) {
+        prev = link->prev;
+        entry = link->data;
+
+        if (_cache_entry_idle (entry)) {
+            g_tree_remove (priv->object_tree, entry->key);
+            g_queue_delete_link (priv->object_queue, link);
+            evicted = g_slist_prepend (evicted, entry);
+            ++priv->evictions;
+        }
+
+        link = prev;
+    }
+
+    return evicted;
+}
+
+/*
+ * Free the evicted entries without the mutex held, the modules of
+ * the objects died meanwhile are released too.
+ */
+static void _gimo_loader_release_evicted (GSList *evicted)
+{
+    if (NULL == evicted)
+        return;
+
+    g_slist_free_full (evicted, _cache_entry_free);
+    _gimo_dlmodule_collect ();
 }
 
 static GimoLoadable* _gimo_loader_load_file (GPtrArray *loaders,
                                              const gchar *suffix,
-                                             const gchar *file_name)
+                                             const gchar *file_name,
+                                             GimoLoaderSetupFunc setup,
+                                             gpointer user_data)
 {
     GimoLoadable *object = NULL;
     struct _FactoryInfo *info;
     guint i;
 
-    if (file_name && !g_file_test (file_name, G_FILE_TEST_EXISTS)) {
-        gimo_set_error_full (GIMO_ERROR_NO_FILE,
-                             "GimoLoader file not exist: %s",
-                             file_name);
-        return NULL;
-    }
-
     for (i = 0; i < loaders->len; ++i) {
         info = g_ptr_array_index (loaders, i);
 
@@ -147,6 +304,9 @@ static GimoLoadable* _gimo_loader_load_file (GPtrArray *loaders,
         object = gimo_safe_cast (gimo_factory_make (info->factory),
                                  GIMO_TYPE_LOADABLE);
         if (object) {
+            if (setup)
+                setup (object, user_data);
+
             if (!gimo_loadable_load (object, file_name)) {
                 g_object_unref (object);
                 object = NULL;
@@ -159,6 +319,75 @@ static GimoLoadable* _gimo_loader_load_file (GPtrArray *loaders,
     return object;
 }
 
+/*
+ * Find the first existing file of the name, from the current
+ * directory and then from the search paths.
+ */
+static gchar* _gimo_loader_find_file (GimoLoader *self,
+                                      const gchar *file_name)
+{
+    GimoLoaderPrivate *priv = self->priv;
+    struct _PathInfo *pi;
+    gchar *full_path = NULL;
+    GList *it;
+
+    if (g_file_test (file_name, G_FILE_TEST_EXISTS))
+        return g_strdup (file_name);
+
+    if (g_path_is_absolute (file_name))
+        return NULL;
+
+    g_mutex_lock (&priv->mutex);
+
+    it = g_queue_peek_head_link (priv->paths);
+    while (it) {
+        pi = it->data;
+        full_path = g_build_filename (pi->path, file_name, NULL);
+
+        if (g_file_test (full_path, G_FILE_TEST_EXISTS))
+            break;
+
+        g_free (full_path);
+        full_path = NULL;
+        it = it->next;
+    }
+
+    g_mutex_unlock (&priv->mutex);
+
+    return full_path;
+}
+
+/*
+ * Ask the kernel to read the file into the page cache ahead, so the
+ * later load doesn't block on the disk.
+ */
+static void _gimo_loader_prefetch_thread (gpointer data,
+                                          gpointer user_data)
+{
+    gchar *file_name = data;
+
+#ifdef HAVE_POSIX_FADVISE
+    int fd = open (file_name, O_RDONLY);
+
+    if (fd != -1) {
+        posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+        close (fd);
+    }
+#else
+    FILE *fp = fopen (file_name, "rb");
+
+    if (fp) {
+        gchar buffer[65536];
+
+        while (fread (buffer, 1, sizeof (buffer), fp) == sizeof (buffer));
+
+        fclose (fp);
+    }
+#endif
+
+    g_free (file_name);
+}
+
 static void gimo_loader_init (GimoLoader *self)
 {
     GimoLoaderPrivate *priv;
@@ -171,8 +400,15 @@ static void gimo_loader_init (GimoLoader *self)
     priv->paths = g_queue_new ();
     priv->loaders = g_queue_new ();
     priv->object_tree = NULL;
-    priv->object_list = NULL;
+    priv->object_queue = NULL;
+    priv->capacity = 0;
+    priv->hits = 0;
+    priv->misses = 0;
+    priv->evictions = 0;
+    priv->pending_tree = NULL;
+    priv->prefetch_pool = NULL;
     g_mutex_init (&priv->mutex);
+    g_cond_init (&priv->cond);
 }
 
 static void gimo_loader_finalize (GObject *gobject)
@@ -180,15 +416,22 @@ static void gimo_loader_finalize (GObject *gobject)
     GimoLoader *self = GIMO_LOADER (gobject);
     GimoLoaderPrivate *priv = self->priv;
 
-    if (priv->object_list)
-        g_slist_free_full (priv->object_list, g_object_unref);
+    if (priv->prefetch_pool)
+        g_thread_pool_free (priv->prefetch_pool, FALSE, TRUE);
 
     if (priv->object_tree)
         g_tree_unref (priv->object_tree);
 
+    if (priv->object_queue)
+        g_queue_free_full (priv->object_queue, _cache_entry_free);
+
+    if (priv->pending_tree)
+        g_tree_unref (priv->pending_tree);
+
     g_queue_free_full (priv->loaders, _factory_info_unref);
     g_queue_free_full (priv->paths, _path_info_unref);
     g_mutex_clear (&priv->mutex);
+    g_cond_clear (&priv->cond);
 
     G_OBJECT_CLASS (gimo_loader_parent_class)->finalize (gobject);
 }
@@ -205,10 +448,17 @@ static void gimo_loader_set_property (GObject *object,
     case PROP_CACHE:
         if (g_value_get_boolean (value)) {
             priv->object_tree = g_tree_new_full (
-                _gimo_gtree_string_compare, NULL, g_free, NULL);
+                _gimo_gtree_string_compare, NULL, NULL, NULL);
+            priv->object_queue = g_queue_new ();
+            priv->pending_tree = g_tree_new_full (
+                _gimo_gtree_string_compare, NULL, NULL, NULL);
         }
         break;
 
+    case PROP_CAPACITY:
+        gimo_loader_set_capacity (self, g_value_get_uint (value));
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -228,6 +478,10 @@ static void gimo_loader_get_property (GObject *object,
         g_value_set_boolean (value, priv->object_tree != NULL);
         break;
 
+    case PROP_CAPACITY:
+        g_value_set_uint (value, priv->capacity);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -255,6 +509,16 @@ static void gimo_loader_class_init (GimoLoaderClass *klass)
                               G_PARAM_WRITABLE |
                               G_PARAM_CONSTRUCT_ONLY |
                               G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property (
+        gobject_class, PROP_CAPACITY,
+        g_param_spec_uint ("capacity",
+                           "Cache capacity",
+                           "Maximum number of cached objects, 0 for unlimited",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_WRITABLE |
+                           G_PARAM_STATIC_STRINGS));
 }
 
 GimoLoader* gimo_loader_new (void)
@@ -441,12 +705,160 @@ void gimo_loader_unregister (GimoLoader *self,
     g_mutex_unlock (&priv->mutex);
 }
 
+/*
+ * Make a file name which identifies the file itself, so all the
+ * relative, symlinked or search path forms of the same file share
+ * one cache entry.
+ */
+static gchar* _gimo_loader_canonicalize (const gchar *file_name)
+{
+    gchar *result;
+
+#ifdef HAVE_REALPATH
+    char *real_path = realpath (file_name, NULL);
+
+    if (real_path) {
+        result = g_strdup (real_path);
+        free (real_path);
+        return result;
+    }
+#endif
+
+    if (g_path_is_absolute (file_name)) {
+        result = g_strdup (file_name);
+    }
+    else {
+        gchar *cur_dir = g_get_current_dir ();
+        result = g_build_filename (cur_dir, file_name, NULL);
+        g_free (cur_dir);
+    }
+
+    return result;
+}
+
+/*
+ * Load a file through the cache, @key identifies the cache entry
+ * and @file_name is passed to the loaded object. Concurrent loads
+ * of the same key are collapsed into one: the first thread loads
+ * the file while the others wait for its result.
+ */
+static GimoLoadable* _gimo_loader_load_cached (GimoLoader *self,
+                                               GPtrArray *loaders,
+                                               const gchar *suffix,
+                                               const gchar *key,
+                                               const gchar *file_name,
+                                               GimoLoaderSetupFunc setup,
+                                               gpointer user_data)
+{
+    GimoLoaderPrivate *priv = self->priv;
+    struct _PendingLoad *pending;
+    GimoLoadable *result = NULL;
+    GList *exist;
+    GSList *evicted = NULL;
+
+    if (NULL == priv->object_tree || NULL == key)
+        return _gimo_loader_load_file (loaders, suffix, file_name,
+                                       setup, user_data);
+
+    g_mutex_lock (&priv->mutex);
+
+    result = _gimo_loader_cache_lookup (self, key);
+    if (result) {
+        g_object_ref (result);
+        g_mutex_unlock (&priv->mutex);
+        return result;
+    }
+
+    pending = g_tree_lookup (priv->pending_tree, key);
+    if (pending) {
+        if (pending->owner == g_thread_self ()) {
+            g_mutex_unlock (&priv->mutex);
+            gimo_set_error_full (GIMO_ERROR_CONFLICT,
+                                 "GimoLoader recursive load: %s",
+                                 key);
+            return NULL;
+        }
+
+        ++pending->ref_count;
+
+        while (!pending->done)
+            g_cond_wait (&priv->cond, &priv->mutex);
+
+        if (pending->result)
+            result = g_object_ref (pending->result);
+
+        _pending_load_unref (pending);
+        g_mutex_unlock (&priv->mutex);
+
+        if (NULL == result) {
+            gimo_set_error_full (GIMO_ERROR_LOAD,
+                                 "GimoLoader load file failed: %s",
+                                 key);
+        }
+
+        return result;
+    }
+
+    pending = g_malloc (sizeof *pending);
+    pending->key = g_strdup (key);
+    pending->owner = g_thread_self ();
+    pending->result = NULL;
+    pending->done = FALSE;
+    pending->ref_count = 1;
+    g_tree_insert (priv->pending_tree, pending->key, pending);
+
+    g_mutex_unlock (&priv->mutex);
+
+    result = _gimo_loader_load_file (loaders, suffix, file_name,
+                                     setup, user_data);
+
+    g_mutex_lock (&priv->mutex);
+
+    g_tree_remove (priv->pending_tree, key);
+
+    if (result) {
+        exist = g_tree_lookup (priv->object_tree, key);
+        if (!exist) {
+            struct _CacheEntry *entry;
+
+            entry = _cache_entry_new (key, result);
+            g_queue_push_head (priv->object_queue, entry);
+            g_tree_insert (priv->object_tree,
+                           entry->key,
+                           g_queue_peek_head_link (priv->object_queue));
+
+            evicted = _gimo_loader_cache_trim (self);
+        }
+        else {
+            g_object_unref (result);
+            result = g_object_ref (
+                ((struct _CacheEntry *) exist->data)->object);
+        }
+
+        pending->result = g_object_ref (result);
+    }
+
+    pending->done = TRUE;
+    _pending_load_unref (pending);
+    g_cond_broadcast (&priv->cond);
+
+    g_mutex_unlock (&priv->mutex);
+
+    _gimo_loader_release_evicted (evicted);
+
+    return result;
+}
+
 /**
  * gimo_loader_load:
  * @self: a #GimoLoader
  * @file_name: the file name
  *
- * Load a file.
+ * Load a file. A relative file name not found from the current
+ * directory is searched in the search paths, a name not found at
+ * all is passed to the loaded object as is. The cached objects
+ * are keyed on the resolved file, so the different names of the
+ * same file share one object.
  *
  * Returns: (allow-none) (transfer full):
  *     A #GimoLoadable if successful, %NULL on error.
@@ -454,11 +866,36 @@ void gimo_loader_unregister (GimoLoader *self,
  */
 GimoLoadable* gimo_loader_load (GimoLoader *self,
                                 const gchar *file_name)
+{
+    return gimo_loader_load_full (self, file_name, NULL, NULL);
+}
+
+/**
+ * gimo_loader_load_full:
+ * @self: a #GimoLoader
+ * @file_name: the file name
+ * @setup: (allow-none) (scope call): the function to setup the object
+ * @user_data: (closure): user data passed to @setup
+ *
+ * Load a file like gimo_loader_load(), @setup is called with a newly
+ * made object before it loads the file, e.g. to set the binding
+ * policy of a #GimoDlmodule. It's not called when the object is
+ * found in the cache.
+ *
+ * Returns: (allow-none) (transfer full):
+ *     A #GimoLoadable if successful, %NULL on error.
+ *     Free the returned object with g_object_unref().
+ */
+GimoLoadable* gimo_loader_load_full (GimoLoader *self,
+                                     const gchar *file_name,
+                                     GimoLoaderSetupFunc setup,
+                                     gpointer user_data)
 {
     GimoLoaderPrivate *priv;
     GList *it;
     guint count;
     GPtrArray *arr;
+    GQueue *paths = NULL;
     const gchar *suffix;
     struct _FactoryInfo *info;
     GimoLoadable *result = NULL;
@@ -486,16 +923,6 @@ GimoLoadable* gimo_loader_load (GimoLoader *self,
         return NULL;
     }
 
-    if (priv->object_tree) {
-        result = g_tree_lookup (priv->object_tree, file_name);
-
-        if (result) {
-            g_object_ref (result);
-            g_mutex_unlock (&priv->mutex);
-            return result;
-        }
-    }
-
     count = g_queue_get_length (priv->loaders);
     if (0 == count) {
         g_mutex_unlock (&priv->mutex);
@@ -511,68 +938,305 @@ GimoLoadable* gimo_loader_load (GimoLoader *self,
         it = it->next;
     }
 
-    g_mutex_unlock (&priv->mutex);
-
-    result = _gimo_loader_load_file (arr, suffix, file_name);
-
-    if (NULL == result && file_name &&
-        !g_path_is_absolute (file_name) &&
+    if (file_name && !g_path_is_absolute (file_name) &&
         g_queue_get_length (priv->paths) > 0)
     {
-        GQueue *paths;
-        GList *it;
-        struct _PathInfo *pi;
-        gchar *full_path;
-
-        g_mutex_lock (&priv->mutex);
-
         paths = g_queue_copy (priv->paths);
         g_queue_foreach (paths, (GFunc) _path_info_ref, NULL);
+    }
 
-        g_mutex_unlock (&priv->mutex);
+    g_mutex_unlock (&priv->mutex);
+
+    if (file_name) {
+        struct _PathInfo *pi;
+        gchar *full_path;
+        gchar *key;
+        gboolean found = FALSE;
+
+        full_path = g_strdup (file_name);
+        it = paths ? g_queue_peek_head_link (paths) : NULL;
+
+        for (;;) {
+            if (g_file_test (full_path, G_FILE_TEST_EXISTS)) {
+                found = TRUE;
+                key = _gimo_loader_canonicalize (full_path);
+                result = _gimo_loader_load_cached (self, arr, suffix,
+                                                   key, full_path,
+                                                   setup, user_data);
+                g_free (key);
+            }
 
-        it = g_queue_peek_head_link (paths);
-        while (it) {
-            pi = it->data;
-            full_path = g_build_filename (pi->path, file_name, NULL);
-            result = _gimo_loader_load_file (arr, suffix, full_path);
             g_free (full_path);
 
-            if (result)
+            if (result || NULL == it)
                 break;
 
+            pi = it->data;
+            full_path = g_build_filename (pi->path, file_name, NULL);
             it = it->next;
         }
 
-        g_queue_free_full (paths, _path_info_unref);
+        /*
+         * The name may be resolved by the loaded object itself,
+         * e.g. a module name or a library in the system paths.
+         */
+        if (!found) {
+            result = _gimo_loader_load_cached (self, arr, suffix,
+                                               file_name, file_name,
+                                               setup, user_data);
+        }
     }
+    else {
+        result = _gimo_loader_load_cached (self, arr, suffix,
+                                           NULL, NULL,
+                                           setup, user_data);
+    }
+
+    if (paths)
+        g_queue_free_full (paths, _path_info_unref);
 
     g_ptr_array_unref (arr);
 
-    if (result && priv->object_tree) {
-        GimoLoadable *exist;
+    return result;
+}
 
-        g_mutex_lock (&priv->mutex);
+static void _async_load_free (gpointer p)
+{
+    struct _AsyncLoad *data = p;
 
-        exist = g_tree_lookup (priv->object_tree, file_name);
-        if (!exist) {
-            g_tree_insert (priv->object_tree,
-                           g_strdup (file_name),
-                           result);
+    if (data->result)
+        g_object_unref (data->result);
+
+    g_free (data->error_string);
+    g_free (data->file_name);
+    g_free (data);
+}
+
+static void _gimo_loader_load_thread (GSimpleAsyncResult *res,
+                                      GObject *object,
+                                      GCancellable *cancellable)
+{
+    struct _AsyncLoad *data;
+
+    data = g_simple_async_result_get_op_res_gpointer (res);
+
+    if (g_cancellable_is_cancelled (cancellable)) {
+        data->error_code = GIMO_ERROR_LOAD;
+        data->error_string = g_strdup_printf (
+            "GimoLoader load cancelled: %s", data->file_name);
+        return;
+    }
+
+    /* The error is per thread, a pool thread keeps the last one. */
+    gimo_clear_error ();
+
+    data->result = gimo_loader_load (GIMO_LOADER (object),
+                                     data->file_name);
+    if (NULL == data->result) {
+        data->error_code = gimo_get_error ();
+        data->error_string = gimo_dup_error_string ();
+    }
+}
+
+static void _gimo_loader_batch_thread (gpointer data,
+                                       gpointer user_data)
+{
+    struct _BatchLoad *batch = user_data;
+    guint index = GPOINTER_TO_UINT (data) - 1;
+    GimoLoadable *object;
+
+    gimo_clear_error ();
+
+    object = gimo_loader_load (batch->loader,
+                               g_ptr_array_index (batch->file_names,
+                                                  index));
+    g_ptr_array_index (batch->results, index) = object;
+
+    if (NULL == object) {
+        g_ptr_array_index (batch->errors, index) =
+            gimo_dup_error_string ();
+    }
+}
+
+/**
+ * gimo_loader_load_async:
+ * @self: a #GimoLoader
+ * @file_name: the file name
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: (scope async): a #GAsyncReadyCallback
+ * @user_data: (closure): user data passed to @callback
+ *
+ * Load a file in a worker thread, the same way as gimo_loader_load().
+ * Call gimo_loader_load_finish() from @callback to get the result.
+ */
+void gimo_loader_load_async (GimoLoader *self,
+                             const gchar *file_name,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+    GSimpleAsyncResult *res;
+    struct _AsyncLoad *data;
+
+    g_return_if_fail (GIMO_IS_LOADER (self));
+
+    data = g_malloc0 (sizeof *data);
+    data->file_name = g_strdup (file_name);
+
+    res = g_simple_async_result_new (G_OBJECT (self),
+                                     callback,
+                                     user_data,
+                                     gimo_loader_load_async);
+    g_simple_async_result_set_op_res_gpointer (res,
+                                               data,
+                                               _async_load_free);
+    g_simple_async_result_run_in_thread (res,
+                                         _gimo_loader_load_thread,
+                                         G_PRIORITY_DEFAULT,
+                                         cancellable);
+    g_object_unref (res);
+}
+
+/**
+ * gimo_loader_load_finish:
+ * @self: a #GimoLoader
+ * @result: the #GAsyncResult passed to the callback
+ *
+ * Finish a load started with gimo_loader_load_async().
+ *
+ * Returns: (allow-none) (transfer full):
+ *     A #GimoLoadable if successful, %NULL on error.
+ *     Free the returned object with g_object_unref().
+ */
+GimoLoadable* gimo_loader_load_finish (GimoLoader *self,
+                                       GAsyncResult *result)
+{
+    struct _AsyncLoad *data;
+
+    g_return_val_if_fail (g_simple_async_result_is_valid (
+        result, G_OBJECT (self), gimo_loader_load_async), NULL);
+
+    data = g_simple_async_result_get_op_res_gpointer (
+        G_SIMPLE_ASYNC_RESULT (result));
+
+    if (data->result)
+        return g_object_ref (data->result);
+
+    gimo_set_error_full (data->error_code, "%s", data->error_string);
+
+    return NULL;
+}
+
+/**
+ * gimo_loader_load_many:
+ * @self: a #GimoLoader
+ * @file_names: (element-type utf8): the file names
+ * @errors: (out) (allow-none) (element-type utf8) (transfer container):
+ *          return location for the error messages
+ *
+ * Load a batch of files concurrently in worker threads. The cache
+ * and the concurrent load collapsing work as with gimo_loader_load().
+ * The returned array matches @file_names index by index, with %NULL
+ * for the files failed to load. The @errors array has the same
+ * length and holds the error message of each failed file, %NULL for
+ * the others. The errors are kept per thread, so each message is
+ * the one of its own file.
+ *
+ * Returns: (element-type Gimo.Loadable) (transfer container):
+ *          An array of the loaded objects.
+ *          Free the returned array with g_ptr_array_unref().
+ */
+GPtrArray* gimo_loader_load_many (GimoLoader *self,
+                                  GPtrArray *file_names,
+                                  GPtrArray **errors)
+{
+    struct _BatchLoad batch;
+    GThreadPool *pool;
+    guint i;
+
+    g_return_val_if_fail (GIMO_IS_LOADER (self), NULL);
+    g_return_val_if_fail (file_names != NULL, NULL);
+
+    batch.loader = self;
+    batch.file_names = file_names;
+    batch.results = g_ptr_array_new_full (file_names->len,
+                                          _gimo_safe_unref);
+    batch.errors = g_ptr_array_new_full (file_names->len, g_free);
+    g_ptr_array_set_size (batch.results, file_names->len);
+    g_ptr_array_set_size (batch.errors, file_names->len);
+
+    pool = NULL;
+    if (file_names->len > 1) {
+        pool = g_thread_pool_new (_gimo_loader_batch_thread,
+                                  &batch,
+                                  MIN (file_names->len,
+                                       GIMO_LOADER_MAX_THREADS),
+                                  FALSE,
+                                  NULL);
+    }
 
-            priv->object_list = g_slist_prepend (priv->object_list,
-                                                 result);
+    for (i = 0; i < file_names->len; ++i) {
+        if (pool) {
+            g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
         }
         else {
-            g_object_unref (result);
-            result = exist;
+            _gimo_loader_batch_thread (GUINT_TO_POINTER (i + 1),
+                                       &batch);
         }
+    }
 
-        g_object_ref (result);
-        g_mutex_unlock (&priv->mutex);
+    if (pool)
+        g_thread_pool_free (pool, FALSE, TRUE);
+
+    if (errors)
+        *errors = batch.errors;
+    else
+        g_ptr_array_unref (batch.errors);
+
+    return batch.results;
+}
+
+/**
+ * gimo_loader_prefetch:
+ * @self: a #GimoLoader
+ * @file_name: the file name
+ *
+ * Resolve a file the same way as gimo_loader_load() and start
+ * reading it into the page cache in a background thread, so a
+ * later load of the file doesn't wait for the disk.
+ *
+ * Returns: %TRUE if the file is found.
+ */
+gboolean gimo_loader_prefetch (GimoLoader *self,
+                               const gchar *file_name)
+{
+    GimoLoaderPrivate *priv;
+    gchar *full_path;
+
+    g_return_val_if_fail (GIMO_IS_LOADER (self), FALSE);
+    g_return_val_if_fail (file_name != NULL, FALSE);
+
+    priv = self->priv;
+
+    full_path = _gimo_loader_find_file (self, file_name);
+    if (NULL == full_path)
+        return FALSE;
+
+    g_mutex_lock (&priv->mutex);
+
+    if (NULL == priv->prefetch_pool) {
+        priv->prefetch_pool = g_thread_pool_new (
+            _gimo_loader_prefetch_thread, NULL, 1, FALSE, NULL);
     }
 
-    return result;
+    g_mutex_unlock (&priv->mutex);
+
+    if (priv->prefetch_pool)
+        g_thread_pool_push (priv->prefetch_pool, full_path, NULL);
+    else
+        g_free (full_path);
+
+    return TRUE;
 }
 
 /**
@@ -599,12 +1263,93 @@ GPtrArray* gimo_loader_query_cached (GimoLoader *self)
 
         g_mutex_lock (&priv->mutex);
 
-        g_tree_foreach (priv->object_tree,
-                        _gimo_loader_query_cached,
-                        result);
+        g_queue_foreach (priv->object_queue,
+                         _gimo_loader_query_cached,
+                         result);
 
         g_mutex_unlock (&priv->mutex);
     }
 
     return result;
 }
+
+/**
+ * gimo_loader_query_cache_stats:
+ * @self: a #GimoLoader
+ * @hits: (out) (allow-none): return location for the cache hits
+ * @misses: (out) (allow-none): return location for the cache misses
+ * @evictions: (out) (allow-none): return location for the evictions
+ *
+ * Query the statistics of the object cache.
+ */
+void gimo_loader_query_cache_stats (GimoLoader *self,
+                                    guint *hits,
+                                    guint *misses,
+                                    guint *evictions)
+{
+    GimoLoaderPrivate *priv;
+
+    g_return_if_fail (GIMO_IS_LOADER (self));
+
+    priv = self->priv;
+
+    g_mutex_lock (&priv->mutex);
+
+    if (hits)
+        *hits = priv->hits;
+
+    if (misses)
+        *misses = priv->misses;
+
+    if (evictions)
+        *evictions = priv->evictions;
+
+    g_mutex_unlock (&priv->mutex);
+}
+
+/**
+ * gimo_loader_set_capacity:
+ * @self: a #GimoLoader
+ * @capacity: the maximum number of cached objects, 0 for unlimited
+ *
+ * Limit the number of cached objects. When the limit is exceeded
+ * the least recently used objects are evicted, but only those no
+ * longer referenced by anyone but the cache, as counted when the
+ * cache is trimmed. An object also held by a language binding
+ * wrapper or another cache stays until that reference is dropped
+ * and a later load trims the cache. The #GimoLoader:capacity
+ * property is notified if it changes.
+ */
+void gimo_loader_set_capacity (GimoLoader *self,
+                               guint capacity)
+{
+    GimoLoaderPrivate *priv;
+    GSList *evicted = NULL;
+    gboolean changed;
+
+    g_return_if_fail (GIMO_IS_LOADER (self));
+
+    priv = self->priv;
+
+    g_mutex_lock (&priv->mutex);
+
+    changed = priv->capacity != capacity;
+    priv->capacity = capacity;
+
+    if (priv->object_tree)
+        evicted = _gimo_loader_cache_trim (self);
+
+    g_mutex_unlock (&priv->mutex);
+
+    _gimo_loader_release_evicted (evicted);
+
+    if (changed)
+        g_object_notify (G_OBJECT (self), "capacity");
+}
+
+guint gimo_loader_get_capacity (GimoLoader *self)
+{
+    g_return_val_if_fail (GIMO_IS_LOADER (self), 0);
+
+    return self->priv->capacity;
+}
@@ -21,6 +21,7 @@
 #define __GIMO_LOADER_H__
 
 #include "gimo-types.h"
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -39,6 +40,9 @@ G_BEGIN_DECLS
 typedef struct _GimoLoaderPrivate GimoLoaderPrivate;
 typedef struct _GimoLoaderClass GimoLoaderClass;
 
+typedef void (*GimoLoaderSetupFunc) (GimoLoadable *object,
+                                     gpointer user_data);
+
 struct _GimoLoader {
     GObject parent_instance;
     GimoLoaderPrivate *priv;
@@ -72,8 +76,39 @@ void gimo_loader_unregister (GimoLoader *self,
 GimoLoadable* gimo_loader_load (GimoLoader *self,
                                 const gchar *file_name);
 
+GimoLoadable* gimo_loader_load_full (GimoLoader *self,
+                                     const gchar *file_name,
+                                     GimoLoaderSetupFunc setup,
+                                     gpointer user_data);
+
+void gimo_loader_load_async (GimoLoader *self,
+                             const gchar *file_name,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data);
+
+GimoLoadable* gimo_loader_load_finish (GimoLoader *self,
+                                       GAsyncResult *result);
+
+GPtrArray* gimo_loader_load_many (GimoLoader *self,
+                                  GPtrArray *file_names,
+                                  GPtrArray **errors);
+
+gboolean gimo_loader_prefetch (GimoLoader *self,
+                               const gchar *file_name);
+
 GPtrArray* gimo_loader_query_cached (GimoLoader *self);
 
+void gimo_loader_query_cache_stats (GimoLoader *self,
+                                    guint *hits,
+                                    guint *misses,
+                                    guint *evictions);
+
+void gimo_loader_set_capacity (GimoLoader *self,
+                               guint capacity);
+
+guint gimo_loader_get_capacity (GimoLoader *self);
+
 G_END_DECLS
 
 #endif /* __GIMO_LOADER_H__ */
@@ -134,6 +134,44 @@ void _gimo_marshal_BOOLEAN__VOID (GClosure *closure,
     g_value_set_boolean (return_value, v_return);
 }
 
+void _gimo_marshal_BOOLEAN__STRING_OBJECT (GClosure *closure,
+                                           GValue *return_value G_GNUC_UNUSED,
+                                           guint n_param_values,
+                                           const GValue *param_values,
+                                           gpointer invocation_hint G_GNUC_UNUSED,
+                                           gpointer marshal_data)
+{
+    typedef gboolean (*GMarshalFunc_BOOLEAN__STRING_OBJECT) (gpointer     data1,
+                                                             gpointer     arg_1,
+                                                             gpointer     arg_2,
+                                                             gpointer     data2);
+    register union { void *v; GMarshalFunc_BOOLEAN__STRING_OBJECT f; } callback;
+    register GCClosure *cc = (GCClosure*) closure;
+    register gpointer data1, data2;
+    gboolean v_return;
+
+    g_return_if_fail (return_value != NULL);
+    g_return_if_fail (n_param_values == 3);
+
+    if (G_CCLOSURE_SWAP_DATA (closure)) {
+        data1 = closure->data;
+        data2 = g_value_peek_pointer (param_values + 0);
+    }
+    else {
+        data1 = g_value_peek_pointer (param_values + 0);
+        data2 = closure->data;
+    }
+
+    callback.v = marshal_data ? marshal_data : cc->callback;
+
+    v_return = callback.f (data1,
+                           g_marshal_value_peek_string (param_values + 1),
+                           g_marshal_value_peek_object (param_values + 2),
+                           data2);
+
+    g_value_set_boolean (return_value, v_return);
+}
+
 void _gimo_marshal_OBJECT__VOID (GClosure *closure,
                                  GValue *return_value G_GNUC_UNUSED,
                                  guint n_param_values,
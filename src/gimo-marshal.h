@@ -38,6 +38,13 @@ void _gimo_marshal_BOOLEAN__VOID (GClosure *closure,
                                   gpointer invocation_hint G_GNUC_UNUSED,
                                   gpointer marshal_data);
 
+void _gimo_marshal_BOOLEAN__STRING_OBJECT (GClosure *closure,
+                                           GValue *return_value G_GNUC_UNUSED,
+                                           guint n_param_values,
+                                           const GValue *param_values,
+                                           gpointer invocation_hint G_GNUC_UNUSED,
+                                           gpointer marshal_data);
+
 void _gimo_marshal_OBJECT__VOID (GClosure *closure,
                                  GValue *return_value G_GNUC_UNUSED,
                                  guint n_param_values,
@@ -18,6 +18,7 @@
  * Boston, MA 02111-1307, USA.
  */
 #include "gimo-module.h"
+#include "gimo-utils.h"
 
 GType gimo_module_get_type (void)
 {
@@ -82,3 +83,41 @@ GObject* gimo_module_resolve (GimoModule *self,
                                                   symbol,
                                                   param);
 }
+
+/**
+ * gimo_module_resolve_many:
+ * @self: a #GimoModule
+ * @symbols: (array zero-terminated=1): the constructor symbols
+ * @param: (allow-none): the parameter for constructors
+ *
+ * Resolve a batch of symbols as object constructors and create
+ * the objects, in one pass over the module.
+ *
+ * Returns: (element-type GObject.Object) (transfer container):
+ *     An array matching @symbols index by index, with %NULL
+ *     for the symbols failed to resolve. Free the returned
+ *     array with g_ptr_array_unref().
+ */
+GPtrArray* gimo_module_resolve_many (GimoModule *self,
+                                     const gchar **symbols,
+                                     GObject *param)
+{
+    GimoModuleInterface *iface;
+    GPtrArray *result;
+    guint i;
+
+    g_return_val_if_fail (GIMO_IS_MODULE (self), NULL);
+    g_return_val_if_fail (symbols != NULL, NULL);
+
+    iface = GIMO_MODULE_GET_IFACE (self);
+
+    if (iface->resolve_many)
+        return iface->resolve_many (self, symbols, param);
+
+    result = g_ptr_array_new_with_free_func (_gimo_safe_unref);
+
+    for (i = 0; symbols[i]; ++i)
+        g_ptr_array_add (result, iface->resolve (self, symbols[i], param));
+
+    return result;
+}
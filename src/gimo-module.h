@@ -33,6 +33,22 @@ G_BEGIN_DECLS
     (G_TYPE_INSTANCE_GET_INTERFACE ((inst), GIMO_TYPE_MODULE, GimoModuleInterface))
 
 typedef struct _GimoModuleInterface GimoModuleInterface;
+typedef struct _GimoModuleSymbol GimoModuleSymbol;
+
+typedef GObject* (*GimoModuleFunc) (GObject *param);
+
+/**
+ * GimoModuleSymbol:
+ * @name: the symbol name
+ * @func: the function creating the object
+ *
+ * A symbol served from a static table instead of the dynamic
+ * linker, by a #GimoModuleDescriptor or a built-in module.
+ */
+struct _GimoModuleSymbol {
+    const gchar *name;
+    GimoModuleFunc func;
+};
 
 struct _GimoModuleInterface {
     GTypeInterface base_iface;
@@ -43,6 +59,9 @@ struct _GimoModuleInterface {
     GObject* (*resolve) (GimoModule *self,
                          const gchar *symbol,
                          GObject *param);
+    GPtrArray* (*resolve_many) (GimoModule *self,
+                                const gchar **symbols,
+                                GObject *param);
 };
 
 GType gimo_module_get_type (void) G_GNUC_CONST;
@@ -58,6 +77,10 @@ GObject* gimo_module_resolve (GimoModule *self,
                               const gchar *symbol,
                               GObject *param);
 
+GPtrArray* gimo_module_resolve_many (GimoModule *self,
+                                     const gchar **symbols,
+                                     GObject *param);
+
 G_END_DECLS
 
 #endif /* __GIMO_MODULE_H__ */
@@ -23,8 +23,10 @@
  */
 
 #include "gimo-plugin.h"
+#include "gimo-builtin.h"
 #include "gimo-context.h"
 #include "gimo-datastore.h"
+#include "gimo-dlmodule.h"
 #include "gimo-error.h"
 #include "gimo-extension.h"
 #include "gimo-extpoint.h"
@@ -75,6 +77,7 @@ enum {
     PROP_PATH,
     PROP_MODULE,
     PROP_SYMBOL,
+    PROP_MODULE_FLAGS,
     PROP_REQUIRES,
     PROP_EXTPOINTS,
     PROP_EXTENSIONS
@@ -89,17 +92,70 @@ struct _GimoPluginPrivate {
     gchar *path;
     gchar *module;
     gchar *symbol;
+    GimoModuleFlags module_flags;
     GPtrArray *requires;
     GPtrArray *extpoints;
     GPtrArray *extensions;
     GimoModule *runtime;
     GimoPluginState state;
+    GMutex checkpoint_mutex;
+    GThread *checkpoint_owner;
+    GimoDataStore *checkpoint;
+    gint dirty;
 };
 
 G_LOCK_DEFINE_STATIC (plugin_lock);
 
 static guint plugin_signals[LAST_SIGNAL] = { 0 };
 
+static void _gimo_plugin_setup_module (GimoLoadable *object,
+                                       gpointer user_data)
+{
+    GimoPlugin *self = user_data;
+
+    if (GIMO_IS_DLMODULE (object))
+        gimo_dlmodule_set_flags (GIMO_DLMODULE (object),
+                                 self->priv->module_flags);
+}
+
+/*
+ * Connect the hooks of the module descriptor, instead of leaving
+ * the module to look them up and connect by itself.
+ */
+static void _gimo_plugin_connect_descriptor (GimoPlugin *self,
+                                             GimoModule *module)
+{
+    const GimoModuleDescriptor *descriptor;
+
+    if (!GIMO_IS_DLMODULE (module))
+        return;
+
+    descriptor = gimo_dlmodule_get_descriptor (GIMO_DLMODULE (module));
+    if (NULL == descriptor)
+        return;
+
+    if (descriptor->start) {
+        g_signal_connect (self,
+                          "start",
+                          G_CALLBACK (descriptor->start),
+                          NULL);
+    }
+
+    if (descriptor->stop) {
+        g_signal_connect (self,
+                          "stop",
+                          G_CALLBACK (descriptor->stop),
+                          NULL);
+    }
+
+    if (descriptor->run) {
+        g_signal_connect (self,
+                          "run",
+                          G_CALLBACK (descriptor->run),
+                          NULL);
+    }
+}
+
 static gboolean _gimo_plugin_load_module (GimoPlugin *self,
                                           GimoContext *context,
                                           GimoLoader *loader)
@@ -109,34 +165,51 @@ static gboolean _gimo_plugin_load_module (GimoPlugin *self,
     GimoLoadable *loadable = NULL;
     GObject *result;
 
-    if (loader) {
-        g_object_ref (loader);
-    }
-    else {
-        loader = gimo_safe_cast (
-            gimo_context_resolve_extpoint (
-                context, "org.gimo.core.loader.module"),
-            GIMO_TYPE_LOADER);
+    if (priv->module && gimo_builtin_exists (priv->module)) {
+        loadable = GIMO_LOADABLE (gimo_builtin_new ());
 
-        if (NULL == loader)
+        if (!gimo_loadable_load (loadable, priv->module)) {
+            g_object_unref (loadable);
             return FALSE;
+        }
     }
+    else {
+        if (loader) {
+            g_object_ref (loader);
+        }
+        else {
+            loader = gimo_safe_cast (
+                gimo_context_resolve_extpoint (
+                    context, "org.gimo.core.loader.module"),
+                GIMO_TYPE_LOADER);
 
-    if (priv->path && priv->module) {
-        gchar *full_path;
+            if (NULL == loader)
+                return FALSE;
+        }
 
-        full_path = g_build_filename (priv->path, priv->module, NULL);
-        loadable = gimo_loader_load (loader, full_path);
-        g_free (full_path);
-    }
+        if (priv->path && priv->module) {
+            gchar *full_path;
+
+            full_path = g_build_filename (priv->path, priv->module, NULL);
+            loadable = gimo_loader_load_full (loader,
+                                              full_path,
+                                              _gimo_plugin_setup_module,
+                                              self);
+            g_free (full_path);
+        }
 
-    if (NULL == loadable)
-        loadable = gimo_loader_load (loader, priv->module);
+        if (NULL == loadable) {
+            loadable = gimo_loader_load_full (loader,
+                                              priv->module,
+                                              _gimo_plugin_setup_module,
+                                              self);
+        }
 
-    g_object_unref (loader);
+        g_object_unref (loader);
 
-    if (NULL == loadable)
-        return FALSE;
+        if (NULL == loadable)
+            return FALSE;
+    }
 
     module = GIMO_MODULE (loadable);
     if (NULL == module) {
@@ -158,6 +231,8 @@ static gboolean _gimo_plugin_load_module (GimoPlugin *self,
 
     G_UNLOCK (plugin_lock);
 
+    _gimo_plugin_connect_descriptor (self, module);
+
     if (priv->symbol) {
         result = gimo_module_resolve (priv->runtime,
                                       priv->symbol,
@@ -310,11 +385,16 @@ static void gimo_plugin_init (GimoPlugin *self)
     priv->path = NULL;
     priv->module = NULL;
     priv->symbol = NULL;
+    priv->module_flags = 0;
     priv->requires = NULL;
     priv->extpoints = NULL;
     priv->extensions = NULL;
     priv->runtime = NULL;
     priv->state = GIMO_PLUGIN_UNINSTALLED;
+    g_mutex_init (&priv->checkpoint_mutex);
+    priv->checkpoint_owner = NULL;
+    priv->checkpoint = NULL;
+    priv->dirty = TRUE;
 }
 
 static void gimo_plugin_finalize (GObject *gobject)
@@ -349,6 +429,11 @@ static void gimo_plugin_finalize (GObject *gobject)
     g_free (priv->module);
     g_free (priv->symbol);
 
+    if (priv->checkpoint)
+        g_object_unref (priv->checkpoint);
+
+    g_mutex_clear (&priv->checkpoint_mutex);
+
     G_OBJECT_CLASS (gimo_plugin_parent_class)->finalize (gobject);
 }
 
@@ -389,6 +474,10 @@ static void gimo_plugin_set_property (GObject *object,
         priv->symbol = g_value_dup_string (value);
         break;
 
+    case PROP_MODULE_FLAGS:
+        priv->module_flags = g_value_get_flags (value);
+        break;
+
     case PROP_REQUIRES:
         {
             GPtrArray *arr = g_value_get_boxed (value);
@@ -468,6 +557,10 @@ static void gimo_plugin_get_property (GObject *object,
         g_value_set_string (value, priv->symbol);
         break;
 
+    case PROP_MODULE_FLAGS:
+        g_value_set_flags (value, priv->module_flags);
+        break;
+
     case PROP_REQUIRES:
         g_value_set_boxed (value, priv->requires);
         break;
@@ -619,6 +712,18 @@ static void gimo_plugin_class_init (GimoPluginClass *klass)
                              G_PARAM_CONSTRUCT_ONLY |
                              G_PARAM_STATIC_STRINGS));
 
+    g_object_class_install_property (
+        gobject_class, PROP_MODULE_FLAGS,
+        g_param_spec_flags ("module-flags",
+                            "Module binding flags",
+                            "The binding policy of the runtime module",
+                            GIMO_TYPE_MODULE_FLAGS,
+                            0,
+                            G_PARAM_READABLE |
+                            G_PARAM_WRITABLE |
+                            G_PARAM_CONSTRUCT_ONLY |
+                            G_PARAM_STATIC_STRINGS));
+
     g_object_class_install_property (
         gobject_class, PROP_REQUIRES,
         g_param_spec_boxed ("requires",
@@ -745,6 +850,13 @@ const gchar* gimo_plugin_get_symbol (GimoPlugin *self)
     return self->priv->symbol;
 }
 
+GimoModuleFlags gimo_plugin_get_module_flags (GimoPlugin *self)
+{
+    g_return_val_if_fail (GIMO_IS_PLUGIN (self), 0);
+
+    return self->priv->module_flags;
+}
+
 /**
  * gimo_plugin_get_extpoint:
  * @self: a #GimoPlugin
@@ -1059,8 +1171,10 @@ gboolean gimo_plugin_start (GimoPlugin *self,
 
     g_object_unref (module);
 
-    if (result)
+    if (result) {
         priv->state = GIMO_PLUGIN_ACTIVE;
+        gimo_plugin_mark_dirty (self);
+    }
 
     return result;
 }
@@ -1091,8 +1205,19 @@ void gimo_plugin_stop (GimoPlugin *self)
     g_object_unref (module);
 
     priv->state = GIMO_PLUGIN_RESOLVED;
+    gimo_plugin_mark_dirty (self);
 }
 
+/**
+ * gimo_plugin_save:
+ * @self: a #GimoPlugin
+ * @store: the store to save the plugin state to
+ *
+ * Emit the #GimoPlugin::save signal. gimo_context_save() calls it
+ * with the checkpoint of the plugin held, a handler which saves the
+ * context again on the same thread gets the last checkpoint of the
+ * plugin instead of a fresh one.
+ */
 void gimo_plugin_save (GimoPlugin *self,
                        GimoDataStore *store)
 {
@@ -1113,6 +1238,87 @@ void gimo_plugin_restore (GimoPlugin *self,
                    plugin_signals[SIG_RESTORE],
                    0,
                    store);
+
+    gimo_plugin_mark_dirty (self);
+}
+
+/**
+ * gimo_plugin_mark_dirty:
+ * @self: a #GimoPlugin
+ *
+ * Mark the state of the plugin as changed, so it's saved again by
+ * the next gimo_context_save(). Plugins call it when the data they
+ * save changes, the plugin is also marked when it's started, stopped
+ * or restored.
+ */
+void gimo_plugin_mark_dirty (GimoPlugin *self)
+{
+    g_return_if_fail (GIMO_IS_PLUGIN (self));
+
+    g_atomic_int_set (&self->priv->dirty, TRUE);
+}
+
+/**
+ * gimo_plugin_is_dirty:
+ * @self: a #GimoPlugin
+ *
+ * Get whether the plugin is changed since it's saved by the last
+ * gimo_context_save().
+ *
+ * Returns: whether the plugin is dirty
+ */
+gboolean gimo_plugin_is_dirty (GimoPlugin *self)
+{
+    g_return_val_if_fail (GIMO_IS_PLUGIN (self), FALSE);
+
+    return g_atomic_int_get (&self->priv->dirty);
+}
+
+/*
+ * Get the saved state of the plugin, it's saved again only if the
+ * plugin is dirty, otherwise the store of the last checkpoint is
+ * reused. The dirty flag is cleared before saving, so the changes
+ * during saving are kept for the next checkpoint.
+ *
+ * The checkpoints of a plugin are serialized, a concurrent call
+ * waits for the store being saved instead of taking the last one.
+ * A save handler saving the context again on the same thread gets
+ * the last checkpoint, or an empty store before the first one.
+ */
+GimoDataStore* _gimo_plugin_checkpoint (GimoPlugin *self)
+{
+    GimoPluginPrivate *priv = self->priv;
+    GimoDataStore *store;
+
+    /* Only this thread may have set itself as the owner. */
+    if (g_atomic_pointer_get (&priv->checkpoint_owner) == g_thread_self ()) {
+        if (priv->checkpoint)
+            return g_object_ref (priv->checkpoint);
+
+        return gimo_data_store_new ();
+    }
+
+    g_mutex_lock (&priv->checkpoint_mutex);
+    g_atomic_pointer_set (&priv->checkpoint_owner, g_thread_self ());
+
+    if (g_atomic_int_compare_and_exchange (&priv->dirty, TRUE, FALSE) ||
+        NULL == priv->checkpoint)
+    {
+        store = gimo_data_store_new ();
+        gimo_plugin_save (self, store);
+
+        if (priv->checkpoint)
+            g_object_unref (priv->checkpoint);
+
+        priv->checkpoint = store;
+    }
+
+    store = g_object_ref (priv->checkpoint);
+
+    g_atomic_pointer_set (&priv->checkpoint_owner, NULL);
+    g_mutex_unlock (&priv->checkpoint_mutex);
+
+    return store;
 }
 
 void _gimo_plugin_install (GimoPlugin *self,
@@ -79,6 +79,8 @@ const gchar* gimo_plugin_get_module (GimoPlugin *self);
 
 const gchar* gimo_plugin_get_symbol (GimoPlugin *self);
 
+GimoModuleFlags gimo_plugin_get_module_flags (GimoPlugin *self);
+
 GimoExtPoint* gimo_plugin_get_extpoint (GimoPlugin *self,
                                         const gchar *local_id);
 
@@ -125,6 +127,10 @@ void gimo_plugin_save (GimoPlugin *self,
 
 void gimo_plugin_restore (GimoPlugin *self,
                           GimoDataStore *store);
+
+void gimo_plugin_mark_dirty (GimoPlugin *self);
+
+gboolean gimo_plugin_is_dirty (GimoPlugin *self);
 G_END_DECLS
 
 #endif /* __GIMO_PLUGIN_H__ */
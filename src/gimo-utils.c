@@ -109,6 +109,12 @@ gpointer gimo_safe_cast (gpointer object, GType type)
     return NULL;
 }
 
+void _gimo_safe_unref (gpointer object)
+{
+    if (object)
+        g_object_unref (object);
+}
+
 gchar* _gimo_symbol_from_type_name (const gchar *name)
 {
     GString *symbol_name = g_string_new ("");
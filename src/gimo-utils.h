@@ -38,6 +38,8 @@ GPtrArray* _gimo_clone_object_array (GPtrArray *arr,
 
 gpointer gimo_safe_cast (gpointer object, GType type);
 
+void _gimo_safe_unref (gpointer object);
+
 gchar* _gimo_symbol_from_type_name (const gchar *name);
 
 GType gimo_resolve_type_lazily (const gchar *name);
@@ -19,15 +19,18 @@
  */
 #include "config.h"
 #include "gimo-xmlarchive.h"
+#include "gimo-bundlearchive.h"
 #include "gimo-context.h"
 #include "gimo-error.h"
+#include "gimo-extconfig.h"
+#include "gimo-extension.h"
+#include "gimo-extpoint.h"
 #include "gimo-factory.h"
 #include "gimo-loader.h"
 #include "gimo-plugin.h"
+#include "gimo-require.h"
 #include "gimo-utils.h"
-#include <ctype.h>
 #include <expat.h>
-#include <stdio.h>
 #include <string.h>
 
 #ifdef XML_LARGE_SIZE
@@ -40,137 +43,490 @@
 # define XML_FMT_INT_MOD "l"
 #endif
 
+/*
+ * The properties of an object type, built once per type and never
+ * changed, so it can be read without lock.
+ */
+struct _TypeInfo {
+    GType type;
+    GObjectClass *klass;
+    GHashTable *props;
+};
+
+/*
+ * A bump allocator for the transient data of a parse, it's reset
+ * after each top level object.
+ */
+struct _ParseArena {
+    GSList *blocks;
+    gchar *pos;
+    gsize left;
+    gsize block_size;
+};
+
+struct _ParseParam {
+    GParameter param;
+    struct _ParseParam *next;
+};
+
+/*
+ * The resolved construction steps of an archive, replayed into the
+ * same objects without parsing or converting anything.
+ */
+enum {
+    PLAN_OP_BEGIN,
+    PLAN_OP_VALUE,
+    PLAN_OP_REF,
+    PLAN_OP_END
+};
+
+struct _PlanOp {
+    guint kind;
+    GType type;
+    GParamSpec *prop;
+    gchar *id;
+    GValue value;
+};
+
+struct _ParsePlan {
+    GArray *ops;
+    gint ref_count;
+};
+
 struct _ParseContext {
     GimoArchive *archive;
+    GHashTable *types;
     GPtrArray *frames;
+    GString *text;
+    GArray *plan;
+    struct _ParseArena arena;
     gint depth;
     gboolean error;
 };
 
 struct _ParseFrame {
     gchar *id;
+    GObject *ref;
+    struct _TypeInfo *info;
     GObjectClass *klass;
     GPtrArray *obj_array;
     GParamSpec *prop;
-    GArray *params;
+    struct _ParseParam *params;
+    guint nparam;
+    gsize text_offset;
+    gboolean has_text;
     GType type;
     GType obj_array_type;
 };
 
+#define PARSE_ARENA_BLOCK_SIZE 4096
+#define PARSE_ARENA_ALIGN 16
+
+extern gboolean _gimo_archive_object_parsed (GimoArchive *self,
+                                             const gchar *id,
+                                             GObject *object);
+
+static GHashTable *type_infos;
+static GHashTable *class_names;
+static GHashTable *plan_cache;
+static GQueue plan_keys = G_QUEUE_INIT;
+static guint plan_cache_size;
+
+G_LOCK_DEFINE_STATIC (type_info_lock);
+G_LOCK_DEFINE_STATIC (class_name_lock);
+G_LOCK_DEFINE_STATIC (plan_cache_lock);
+
 static void gimo_loadable_interface_init (GimoLoadableInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (GimoXmlArchive, gimo_xmlarchive, GIMO_TYPE_ARCHIVE,
                          G_IMPLEMENT_INTERFACE (GIMO_TYPE_LOADABLE,
                                                 gimo_loadable_interface_init))
 
-#define DEFINE_SSCANF(func_name, to_member, format) \
-    static void _value_transform_##func_name (const GValue *src_value, \
-                                              GValue *dest_value)      \
-    { \
-        sscanf (src_value->data[0].v_pointer, (format), \
-                &dest_value->data[0].to_member); \
-    } extern void glib_dummy_decl (void)
-
-DEFINE_SSCANF (string_int,     v_int,    "%d");
-DEFINE_SSCANF (string_uint,    v_uint,   "%u");
-DEFINE_SSCANF (string_long,    v_long,   "%ld");
-DEFINE_SSCANF (string_ulong,   v_ulong,  "%lu");
-DEFINE_SSCANF (string_int64,   v_int64,  "%" G_GINT64_FORMAT);
-DEFINE_SSCANF (string_uint64,  v_uint64, "%" G_GUINT64_FORMAT);
-DEFINE_SSCANF (string_float,   v_float,  "%f");
-DEFINE_SSCANF (string_double,  v_double, "%lf");
-
-static void _value_transform_string_bool (const GValue *src_value,
-                                          GValue *dest_value)
-{
-    if (strcmp (src_value->data[0].v_pointer, "TRUE") == 0)
-        dest_value->data[0].v_int = TRUE;
-    else
-        dest_value->data[0].v_int = FALSE;
-}
-
-static void _value_transform_string_enum (const GValue *src_value,
-                                          GValue *dest_value)
-{
-    GEnumClass *klass = g_type_class_ref (G_VALUE_TYPE (dest_value));
-    GEnumValue *enum_value = NULL;
-    gchar *str = g_strdup (src_value->data[0].v_pointer);
-    gchar *name, *end;
-
-    name = str;
-    while (isblank (*name))
-        ++name;
-
-    if (*name) {
-        end = name;
-        while (*end && !isblank (*end))
-            ++end;
+/*
+ * Parse an integer, leading spaces and trailing characters are
+ * ignored as sscanf () did.
+ */
+static gboolean _gimo_xml_parse_int (const gchar *str, gint64 *result)
+{
+    gchar *end;
 
-        *end = '\0';
+    *result = g_ascii_strtoll (str, &end, 10);
 
-        enum_value = g_enum_get_value_by_name (klass, name);
-    }
+    return end != str;
+}
 
-    if (enum_value) {
-        dest_value->data[0].v_long = enum_value->value;
-    }
-    else {
-        sscanf (src_value->data[0].v_pointer, "%ld",
-                &dest_value->data[0].v_long);
+static gboolean _gimo_xml_parse_uint (const gchar *str, guint64 *result)
+{
+    gchar *end;
+
+    *result = g_ascii_strtoull (str, &end, 10);
+
+    return end != str;
+}
+
+static gboolean _gimo_xml_parse_double (const gchar *str, gdouble *result)
+{
+    gchar *end;
+
+    *result = g_ascii_strtod (str, &end);
+
+    return end != str;
+}
+
+/*
+ * Lookup an enum value by name, nick or number. The string doesn't
+ * need to be terminated after @len.
+ */
+static gboolean _gimo_xml_parse_enum_token (GEnumClass *klass,
+                                            const gchar *str,
+                                            gsize len,
+                                            gint64 *result)
+{
+    GEnumValue *enum_value;
+    guint i;
+
+    for (i = 0; i < klass->n_values; ++i) {
+        enum_value = klass->values + i;
+
+        if ((strncmp (enum_value->value_name, str, len) == 0 &&
+             '\0' == enum_value->value_name[len]) ||
+            (strncmp (enum_value->value_nick, str, len) == 0 &&
+             '\0' == enum_value->value_nick[len]))
+        {
+            *result = enum_value->value;
+            return TRUE;
+        }
     }
 
-    g_free (str);
-    g_type_class_unref (klass);
+    return _gimo_xml_parse_int (str, result);
 }
 
-static void _value_transform_string_flags (const GValue *src_value,
-                                           GValue *dest_value)
+static gboolean _gimo_xml_parse_flags_token (GFlagsClass *klass,
+                                             const gchar *str,
+                                             gsize len,
+                                             guint64 *result)
 {
-    GFlagsClass *klass = g_type_class_ref (G_VALUE_TYPE (dest_value));
-    gchar *str = g_strdup (src_value->data[0].v_pointer);
-    gchar *name, *end;
     GFlagsValue *flags_value;
-    gboolean stop = FALSE;
+    guint i;
+
+    for (i = 0; i < klass->n_values; ++i) {
+        flags_value = klass->values + i;
+
+        if ((strncmp (flags_value->value_name, str, len) == 0 &&
+             '\0' == flags_value->value_name[len]) ||
+            (strncmp (flags_value->value_nick, str, len) == 0 &&
+             '\0' == flags_value->value_nick[len]))
+        {
+            *result = flags_value->value;
+            return TRUE;
+        }
+    }
+
+    return _gimo_xml_parse_uint (str, result);
+}
+
+static gboolean _gimo_xml_parse_enum (GType type,
+                                      const gchar *str,
+                                      gint64 *result)
+{
+    /* The class is held by the param spec. */
+    GEnumClass *klass = g_type_class_peek (type);
+    const gchar *end;
+
+    while (g_ascii_isspace (*str))
+        ++str;
+
+    end = str;
+    while (*end && !g_ascii_isspace (*end))
+        ++end;
+
+    if (end == str)
+        return FALSE;
+
+    return _gimo_xml_parse_enum_token (klass, str, end - str, result);
+}
 
-    name = str;
-    while (!stop) {
-        while (isblank (*name) || *name == '|')
-            ++name;
+static gboolean _gimo_xml_parse_flags (GType type,
+                                       const gchar *str,
+                                       guint64 *result)
+{
+    GFlagsClass *klass = g_type_class_peek (type);
+    const gchar *end;
+    guint64 value;
+
+    *result = 0;
 
-        if (!*name)
+    for (;;) {
+        while (g_ascii_isspace (*str) || '|' == *str)
+            ++str;
+
+        if ('\0' == *str)
             break;
 
-        end = name;
-        while (*end && !isblank (*end) && *end != '|')
+        end = str;
+        while (*end && !g_ascii_isspace (*end) && *end != '|')
             ++end;
 
-        if (*end)
-            *end = '\0';
-        else
-            stop = TRUE;
+        if (!_gimo_xml_parse_flags_token (klass, str, end - str, &value))
+            return FALSE;
 
-        flags_value = g_flags_get_value_by_name (klass, name);
-        if (flags_value) {
-            dest_value->data[0].v_ulong |= flags_value->value;
-        }
-        else {
-            glong value = 0;
+        *result |= value;
+        str = end;
+    }
+
+    return TRUE;
+}
 
-            sscanf (name, "%ld", &value);
-            dest_value->data[0].v_ulong |= value;
+/*
+ * Convert the text of a property to @value, which is initialized to
+ * the property type. Only the archive uses these conversions, the
+ * process wide GValue transformations are left untouched.
+ */
+static gboolean _gimo_xml_convert_value (const gchar *str,
+                                         GValue *value)
+{
+    GType type = G_VALUE_TYPE (value);
+    gint64 i64;
+    guint64 u64;
+    gdouble d;
+
+    switch (G_TYPE_FUNDAMENTAL (type)) {
+    case G_TYPE_STRING:
+        g_value_set_string (value, str);
+        return TRUE;
+
+    case G_TYPE_BOOLEAN:
+        g_value_set_boolean (value, strcmp (str, "TRUE") == 0);
+        return TRUE;
+
+    case G_TYPE_CHAR:
+        if (!_gimo_xml_parse_int (str, &i64))
+            return FALSE;
+
+        g_value_set_schar (value, (gint8) i64);
+        return TRUE;
+
+    case G_TYPE_UCHAR:
+        if (!_gimo_xml_parse_uint (str, &u64))
+            return FALSE;
+
+        g_value_set_uchar (value, (guchar) u64);
+        return TRUE;
+
+    case G_TYPE_INT:
+        if (!_gimo_xml_parse_int (str, &i64))
+            return FALSE;
+
+        g_value_set_int (value, (gint) i64);
+        return TRUE;
+
+    case G_TYPE_UINT:
+        if (!_gimo_xml_parse_uint (str, &u64))
+            return FALSE;
+
+        g_value_set_uint (value, (guint) u64);
+        return TRUE;
+
+    case G_TYPE_LONG:
+        if (!_gimo_xml_parse_int (str, &i64))
+            return FALSE;
+
+        g_value_set_long (value, (glong) i64);
+        return TRUE;
+
+    case G_TYPE_ULONG:
+        if (!_gimo_xml_parse_uint (str, &u64))
+            return FALSE;
+
+        g_value_set_ulong (value, (gulong) u64);
+        return TRUE;
+
+    case G_TYPE_INT64:
+        if (!_gimo_xml_parse_int (str, &i64))
+            return FALSE;
+
+        g_value_set_int64 (value, i64);
+        return TRUE;
+
+    case G_TYPE_UINT64:
+        if (!_gimo_xml_parse_uint (str, &u64))
+            return FALSE;
+
+        g_value_set_uint64 (value, u64);
+        return TRUE;
+
+    case G_TYPE_FLOAT:
+        if (!_gimo_xml_parse_double (str, &d))
+            return FALSE;
+
+        g_value_set_float (value, (gfloat) d);
+        return TRUE;
+
+    case G_TYPE_DOUBLE:
+        if (!_gimo_xml_parse_double (str, &d))
+            return FALSE;
+
+        g_value_set_double (value, d);
+        return TRUE;
+
+    case G_TYPE_ENUM:
+        if (!_gimo_xml_parse_enum (type, str, &i64))
+            return FALSE;
+
+        g_value_set_enum (value, (gint) i64);
+        return TRUE;
+
+    case G_TYPE_FLAGS:
+        if (!_gimo_xml_parse_flags (type, str, &u64))
+            return FALSE;
+
+        g_value_set_flags (value, (guint) u64);
+        return TRUE;
+
+    default:
+        {
+            GValue src_val = G_VALUE_INIT;
+            gboolean result;
+
+            g_value_init (&src_val, G_TYPE_STRING);
+            g_value_set_static_string (&src_val, str);
+            result = g_value_transform (&src_val, value);
+            g_value_unset (&src_val);
+
+            return result;
         }
+    }
+}
+
+/*
+ * The class is referenced for ever, the entries are shared by
+ * all the parses in the process.
+ */
+static struct _TypeInfo* _type_info_new (GType type)
+{
+    struct _TypeInfo *info;
+    GParamSpec **props;
+    guint i, count;
+
+    info = g_malloc (sizeof *info);
+    info->type = type;
+    info->klass = g_type_class_ref (type);
+    info->props = g_hash_table_new (g_str_hash, g_str_equal);
+
+    props = g_object_class_list_properties (info->klass, &count);
+
+    for (i = 0; i < count; ++i) {
+        g_hash_table_insert (info->props,
+                             (gpointer) props[i]->name,
+                             props[i]);
+    }
+
+    g_free (props);
+
+    return info;
+}
+
+static struct _TypeInfo* _type_info_lookup (struct _ParseContext *c,
+                                            GType type)
+{
+    struct _TypeInfo *info;
+
+    info = g_hash_table_lookup (c->types, GSIZE_TO_POINTER (type));
+    if (info)
+        return info;
+
+    G_LOCK (type_info_lock);
+
+    if (NULL == type_infos)
+        type_infos = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-        name = end + 1;
+    info = g_hash_table_lookup (type_infos, GSIZE_TO_POINTER (type));
+    if (NULL == info) {
+        info = _type_info_new (type);
+        g_hash_table_insert (type_infos, GSIZE_TO_POINTER (type), info);
     }
 
-    g_free (str);
-    g_type_class_unref (klass);
+    G_UNLOCK (type_info_lock);
+
+    g_hash_table_insert (c->types, GSIZE_TO_POINTER (type), info);
+
+    return info;
+}
+
+static GParamSpec* _type_info_find_property (struct _TypeInfo *info,
+                                             const gchar *name)
+{
+    GParamSpec *prop;
+
+    prop = g_hash_table_lookup (info->props, name);
+    if (prop)
+        return prop;
+
+    /* Names not in canonical form, e.g. with '_'. */
+    return g_object_class_find_property (info->klass, name);
+}
+
+static gpointer _parse_arena_alloc (struct _ParseArena *arena,
+                                    gsize size)
+{
+    gpointer result;
+
+    size = (size + PARSE_ARENA_ALIGN - 1) & ~(gsize) (PARSE_ARENA_ALIGN - 1);
+
+    if (size > arena->left) {
+        arena->block_size = MAX (size, PARSE_ARENA_BLOCK_SIZE);
+        arena->pos = g_malloc (arena->block_size);
+        arena->left = arena->block_size;
+        arena->blocks = g_slist_prepend (arena->blocks, arena->pos);
+    }
+
+    result = arena->pos;
+    arena->pos += size;
+    arena->left -= size;
+
+    return result;
+}
+
+static gchar* _parse_arena_strdup (struct _ParseArena *arena,
+                                   const gchar *str)
+{
+    gsize len;
+    gchar *result;
+
+    if (NULL == str)
+        return NULL;
+
+    len = strlen (str) + 1;
+    result = _parse_arena_alloc (arena, len);
+    memcpy (result, str, len);
+
+    return result;
 }
 
-static void _parse_param_destroy (gpointer p)
+/* Release all the allocations, keep the last block for reuse. */
+static void _parse_arena_reset (struct _ParseArena *arena)
 {
-    GParameter *param = p;
-    g_value_unset (&param->value);
+    GSList *rest;
+
+    if (NULL == arena->blocks)
+        return;
+
+    rest = arena->blocks->next;
+    arena->blocks->next = NULL;
+    g_slist_free_full (rest, g_free);
+
+    arena->pos = arena->blocks->data;
+    arena->left = arena->block_size;
+}
+
+static void _parse_arena_clear (struct _ParseArena *arena)
+{
+    g_slist_free_full (arena->blocks, g_free);
+
+    arena->blocks = NULL;
+    arena->pos = NULL;
+    arena->left = 0;
+    arena->block_size = 0;
 }
 
 static const char* _gimo_xml_find_attr (const char **attr,
@@ -189,14 +545,55 @@ static const char* _gimo_xml_find_attr (const char **attr,
     return NULL;
 }
 
+static void _gimo_class_name_insert (const gchar *name, GType type)
+{
+    g_hash_table_insert (class_names,
+                         g_strdup (name),
+                         GSIZE_TO_POINTER (type));
+}
+
+/*
+ * Resolve a class name, the result is cached for the process, even if
+ * not found. A missing name is checked again only with the cheap
+ * g_type_from_name (), it may have been registered since.
+ */
 static GType _gimo_class_from_name (const gchar *name)
 {
+    gpointer value = NULL;
+    gboolean found;
     GType type;
 
-    type = g_type_from_name (name);
+    G_LOCK (class_name_lock);
+
+    if (NULL == class_names) {
+        class_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, NULL);
+
+        _gimo_class_name_insert ("GimoPlugin", GIMO_TYPE_PLUGIN);
+        _gimo_class_name_insert ("GimoRequire", GIMO_TYPE_REQUIRE);
+        _gimo_class_name_insert ("GimoExtPoint", GIMO_TYPE_EXTPOINT);
+        _gimo_class_name_insert ("GimoExtension", GIMO_TYPE_EXTENSION);
+        _gimo_class_name_insert ("GimoExtConfig", GIMO_TYPE_EXTCONFIG);
+    }
+
+    found = g_hash_table_lookup_extended (class_names, name, NULL, &value);
 
-    if (!type)
-        type = gimo_resolve_type_lazily (name);
+    G_UNLOCK (class_name_lock);
+
+    type = GPOINTER_TO_SIZE (value);
+
+    if (!type) {
+        type = g_type_from_name (name);
+
+        if (!type && !found)
+            type = gimo_resolve_type_lazily (name);
+
+        if (type || !found) {
+            G_LOCK (class_name_lock);
+            _gimo_class_name_insert (name, type);
+            G_UNLOCK (class_name_lock);
+        }
+    }
 
     if (!type) {
         g_warning ("XmlArchive type not exists: %s", name);
@@ -211,31 +608,157 @@ static GType _gimo_class_from_name (const gchar *name)
     return type;
 }
 
-static void _parse_frame_add_param (struct _ParseFrame *f,
+static void _plan_op_clear (gpointer p)
+{
+    struct _PlanOp *op = p;
+
+    g_free (op->id);
+
+    if (G_IS_VALUE (&op->value))
+        g_value_unset (&op->value);
+}
+
+static GArray* _plan_ops_new (void)
+{
+    GArray *ops;
+
+    ops = g_array_new (FALSE, TRUE, sizeof (struct _PlanOp));
+    g_array_set_clear_func (ops, _plan_op_clear);
+
+    return ops;
+}
+
+static void _parse_plan_unref (gpointer p)
+{
+    struct _ParsePlan *plan = p;
+
+    if (g_atomic_int_dec_and_test (&plan->ref_count)) {
+        g_array_unref (plan->ops);
+        g_free (plan);
+    }
+}
+
+/* Record a step of the parse, if it's being recorded. */
+static void _parse_plan_add (struct _ParseContext *c,
+                             guint kind,
+                             GType type,
+                             GParamSpec *prop,
+                             const gchar *id,
+                             const GValue *value)
+{
+    struct _PlanOp *op;
+
+    if (NULL == c->plan)
+        return;
+
+    g_array_set_size (c->plan, c->plan->len + 1);
+    op = &g_array_index (c->plan, struct _PlanOp, c->plan->len - 1);
+
+    op->kind = kind;
+    op->type = type;
+    op->prop = prop;
+    op->id = g_strdup (id);
+
+    if (value) {
+        g_value_init (&op->value, G_VALUE_TYPE (value));
+        g_value_copy (value, &op->value);
+    }
+}
+
+/* Something is skipped, the result can't be replayed. */
+static void _parse_plan_drop (struct _ParseContext *c)
+{
+    if (c->plan) {
+        g_array_unref (c->plan);
+        c->plan = NULL;
+    }
+}
+
+static void _parse_plan_cache_trim (guint size)
+{
+    gchar *key;
+
+    while (g_queue_get_length (&plan_keys) > size) {
+        key = g_queue_pop_head (&plan_keys);
+        g_hash_table_remove (plan_cache, key);
+    }
+}
+
+static struct _ParsePlan* _parse_plan_cache_lookup (const gchar *key)
+{
+    struct _ParsePlan *plan = NULL;
+
+    G_LOCK (plan_cache_lock);
+
+    if (plan_cache) {
+        plan = g_hash_table_lookup (plan_cache, key);
+        if (plan)
+            g_atomic_int_inc (&plan->ref_count);
+    }
+
+    G_UNLOCK (plan_cache_lock);
+
+    return plan;
+}
+
+/* The oldest plan is evicted first. */
+static void _parse_plan_cache_insert (const gchar *key,
+                                      GArray *ops)
+{
+    struct _ParsePlan *plan;
+    gchar *new_key;
+
+    G_LOCK (plan_cache_lock);
+
+    if (plan_cache_size > 0) {
+        if (NULL == plan_cache) {
+            plan_cache = g_hash_table_new_full (g_str_hash,
+                                                g_str_equal,
+                                                g_free,
+                                                _parse_plan_unref);
+        }
+
+        if (!g_hash_table_lookup (plan_cache, key)) {
+            _parse_plan_cache_trim (plan_cache_size - 1);
+
+            plan = g_malloc (sizeof *plan);
+            plan->ops = g_array_ref (ops);
+            plan->ref_count = 1;
+
+            new_key = g_strdup (key);
+            g_hash_table_insert (plan_cache, new_key, plan);
+            g_queue_push_tail (&plan_keys, new_key);
+        }
+    }
+
+    G_UNLOCK (plan_cache_lock);
+}
+
+static void _parse_frame_add_param (struct _ParseContext *c,
+                                    struct _ParseFrame *f,
                                     const gchar *name,
                                     const GValue *value)
 {
-    GParameter param;
+    struct _ParseParam *param;
 
     g_assert (f->klass);
 
-    if (NULL == f->params) {
-        f->params = g_array_new (FALSE, FALSE, sizeof (GParameter));
-        g_array_set_clear_func (f->params, _parse_param_destroy);
-    }
+    param = _parse_arena_alloc (&c->arena, sizeof *param);
+    param->param.name = name;
+    param->param.value = *value;
+    param->next = f->params;
 
-    param.name = name;
-    param.value = *value;
-    g_array_append_val (f->params, param);
+    f->params = param;
+    ++f->nparam;
 }
 
-static void _parse_frame_set_property (struct _ParseFrame *f,
+static void _parse_frame_set_property (struct _ParseContext *c,
+                                       struct _ParseFrame *f,
                                        GParamSpec *prop,
                                        gpointer object,
                                        const gchar *name,
                                        const gchar *value)
 {
-    GValue src_val = G_VALUE_INIT;
     GValue dest_val = G_VALUE_INIT;
 
     if (f->obj_array) {
@@ -261,65 +784,78 @@ static void _parse_frame_set_property (struct _ParseFrame *f,
         else {
             g_warning ("XmlArchive invalid property type: %s",
                        g_type_name (type));
+            _parse_plan_drop (c);
             return;
         }
 
-        _parse_frame_add_param (f, prop->name, &dest_val);
+        _parse_frame_add_param (c, f, prop->name, &dest_val);
         return;
     }
 
     if (NULL == prop) {
         g_assert (f->klass && name);
 
-        prop = g_object_class_find_property (f->klass, name);
+        prop = _type_info_find_property (f->info, name);
         if (NULL == prop) {
             g_warning ("XmlArchive invalid property: %s", name);
+            _parse_plan_drop (c);
             return;
         }
     }
 
-    g_value_init (&src_val, G_TYPE_STRING);
     g_value_init (&dest_val, G_PARAM_SPEC_VALUE_TYPE (prop));
 
-    g_value_set_static_string (&src_val, value);
-
-    if (g_value_transform (&src_val, &dest_val)) {
-        _parse_frame_add_param (f, prop->name, &dest_val);
+    if (_gimo_xml_convert_value (value, &dest_val)) {
+        _parse_plan_add (c, PLAN_OP_VALUE, 0, prop, NULL, &dest_val);
+        _parse_frame_add_param (c, f, prop->name, &dest_val);
     }
     else {
+        g_value_unset (&dest_val);
         g_warning ("XmlArchive transform property error: %s", prop->name);
+        _parse_plan_drop (c);
     }
 }
 
-static struct _ParseFrame* _parse_frame_create (const gchar *id,
+static struct _ParseFrame* _parse_frame_create (struct _ParseContext *c,
+                                                const gchar *id,
                                                 GType type,
                                                 GParamSpec *prop,
                                                 const gchar **attr)
 {
     struct _ParseFrame *f;
 
-    f = g_malloc (sizeof *f);
+    f = _parse_arena_alloc (&c->arena, sizeof *f);
 
-    f->id = g_strdup (id);
+    f->id = _parse_arena_strdup (&c->arena, id);
+    f->ref = NULL;
+    f->info = NULL;
     f->klass = NULL;
     f->obj_array = NULL;
     f->obj_array_type = 0;
     f->prop = prop;
     f->params = NULL;
+    f->nparam = 0;
+    f->text_offset = c->text->len;
+    f->has_text = FALSE;
     f->type = type;
 
     if (prop) {
-        g_assert (!id && !type);
+        g_assert (!id);
 
-        f->type = G_PARAM_SPEC_VALUE_TYPE (prop);
+        if (!type)
+            f->type = G_PARAM_SPEC_VALUE_TYPE (prop);
     }
 
+    if (G_TYPE_IS_OBJECT (f->type) || GIMO_TYPE_OBJECT_ARRAY == f->type)
+        _parse_plan_add (c, PLAN_OP_BEGIN, f->type, prop, id, NULL);
+
     if (G_TYPE_IS_OBJECT (f->type)) {
-        f->klass = g_type_class_ref (f->type);
+        f->info = _type_info_lookup (c, f->type);
+        f->klass = f->info->klass;
 
         while (*attr) {
             _parse_frame_set_property (
-                f, NULL, NULL, attr[0], attr[1]);
+                c, f, NULL, NULL, attr[0], attr[1]);
 
             attr += 2;
         }
@@ -337,21 +873,75 @@ static struct _ParseFrame* _parse_frame_create (const gchar *id,
     return f;
 }
 
+/*
+ * Resolve a ref="ID" attribute, against the archive being read and
+ * then its shared archives.
+ */
+static GObject* _parse_resolve_ref (struct _ParseContext *c,
+                                    const gchar *id,
+                                    GType type)
+{
+    GObject *object;
+
+    object = gimo_archive_resolve_object (c->archive, id);
+    if (NULL == object) {
+        g_warning ("XmlArchive reference not found: %s", id);
+        return NULL;
+    }
+
+    if (!g_type_is_a (G_OBJECT_TYPE (object), type)) {
+        g_warning ("XmlArchive invalid reference type: %s: %s",
+                   id, G_OBJECT_TYPE_NAME (object));
+        g_object_unref (object);
+        return NULL;
+    }
+
+    return object;
+}
+
+/*
+ * The element stands for a shared object, it's given to the parent
+ * frame as is when the element ends.
+ */
+static void _parse_frame_push_ref (struct _ParseContext *c,
+                                   GParamSpec *prop,
+                                   GType type,
+                                   const gchar *id)
+{
+    struct _ParseFrame *f;
+    GObject *object;
+
+    object = _parse_resolve_ref (c, id, type);
+    if (NULL == object)
+        return;
+
+    _parse_plan_add (c, PLAN_OP_REF, type, prop, id, NULL);
+
+    f = _parse_arena_alloc (&c->arena, sizeof *f);
+    memset (f, 0, sizeof *f);
+    f->ref = object;
+    f->prop = prop;
+    f->type = G_OBJECT_TYPE (object);
+    f->text_offset = c->text->len;
+
+    g_ptr_array_add (c->frames, f);
+}
+
+/* The frame memory belongs to the arena, only the values are freed. */
 static void _parse_frame_destroy (gpointer p)
 {
     struct _ParseFrame *f = p;
+    struct _ParseParam *it;
 
     if (f) {
         if (f->obj_array)
             g_ptr_array_unref (f->obj_array);
-        else if (f->klass)
-            g_type_class_unref (f->klass);
 
-        if (f->params)
-            g_array_unref (f->params);
+        if (f->ref)
+            g_object_unref (f->ref);
 
-        g_free (f->id);
-        g_free (f);
+        for (it = f->params; it; it = it->next)
+            g_value_unset (&it->param.value);
     }
 }
 
@@ -361,7 +951,14 @@ static struct _ParseContext* _parse_context_create (GimoArchive *archive)
 
     c = g_malloc (sizeof *c);
     c->archive = archive;
+    c->types = g_hash_table_new (g_direct_hash, g_direct_equal);
     c->frames = g_ptr_array_new_with_free_func (_parse_frame_destroy);
+    c->text = g_string_sized_new (256);
+    c->plan = NULL;
+    c->arena.blocks = NULL;
+    c->arena.pos = NULL;
+    c->arena.left = 0;
+    c->arena.block_size = 0;
     c->depth = 0;
     c->error = FALSE;
 
@@ -373,20 +970,17 @@ static void _parse_context_destroy (gpointer p)
     struct _ParseContext *c = p;
 
     g_ptr_array_unref (c->frames);
+    g_hash_table_unref (c->types);
+    g_string_free (c->text, TRUE);
+    _parse_plan_drop (c);
+    _parse_arena_clear (&c->arena);
     g_free (c);
 }
 
-static void _gimo_xml_start_element (void *data,
-                                     const char *el,
-                                     const char **attr)
+static void _gimo_xml_push_element (struct _ParseContext *c,
+                                    const char *el,
+                                    const char **attr)
 {
-    struct _ParseContext *c = data;
-
-    ++c->depth;
-
-    if (c->error)
-        return;
-
     if (c->frames->len > 0) {
         struct _ParseFrame *p, *f;
 
@@ -396,19 +990,58 @@ static void _gimo_xml_start_element (void *data,
                 /* Object property. */
                 GParamSpec *prop;
 
-                prop = g_object_class_find_property (p->klass, el);
-                if (prop) {
-                    f = _parse_frame_create (NULL, 0, prop, attr);
-                    g_ptr_array_add (c->frames, f);
+                GType el_type = 0;
+
+                prop = _type_info_find_property (p->info, el);
+                if (prop && G_TYPE_IS_OBJECT (G_PARAM_SPEC_VALUE_TYPE (prop)) &&
+                    attr[0] && strcmp (attr[0], "ref") == 0)
+                {
+                    /* A shared object. */
+                    _parse_frame_push_ref (c, prop,
+                                           G_PARAM_SPEC_VALUE_TYPE (prop),
+                                           attr[1]);
+                    return;
+                }
+
+                if (prop && G_TYPE_IS_OBJECT (G_PARAM_SPEC_VALUE_TYPE (prop)) &&
+                    attr[0] && strcmp (attr[0], "class") == 0)
+                {
+                    /* The value is of a derived class. */
+                    el_type = _gimo_class_from_name (attr[1]);
+                    if (!el_type)
+                        return;
+
+                    if (!g_type_is_a (el_type, G_PARAM_SPEC_VALUE_TYPE (prop))) {
+                        g_warning ("XmlArchive invalid property class: %s: %s",
+                                   el, attr[1]);
+                        return;
+                    }
+
+                    attr += 2;
+                }
+
+                if (prop) {
+                    f = _parse_frame_create (c, NULL, el_type, prop, attr);
+                    g_ptr_array_add (c->frames, f);
+                }
+                else {
+                    g_warning ("XmlArchive invalid property: %s", el);
+                }
+            }
+            else if (p->obj_array) {
+                /* Object array element. */
+                const gchar *val;
+                GType el_type;
+
+                val = _gimo_xml_find_attr (attr, 0, "ref");
+                if (val) {
+                    el_type = p->obj_array_type;
+                    if (!el_type)
+                        el_type = G_TYPE_OBJECT;
+
+                    _parse_frame_push_ref (c, NULL, el_type, val);
+                    return;
                 }
-                else {
-                    g_warning ("XmlArchive invalid property: %s", el);
-                }
-            }
-            else if (p->obj_array) {
-                /* Object array element. */
-                const gchar *val;
-                GType el_type;
 
                 val = _gimo_xml_find_attr (attr, 0, "class");
                 if (val) {
@@ -427,7 +1060,7 @@ static void _gimo_xml_start_element (void *data,
                     }
                 }
 
-                f = _parse_frame_create (NULL, el_type, NULL, attr);
+                f = _parse_frame_create (c, NULL, el_type, NULL, attr);
                 g_ptr_array_add (c->frames, f);
             }
             else {
@@ -462,7 +1095,7 @@ static void _gimo_xml_start_element (void *data,
             if (val)
                 attr += 2;
 
-            f = _parse_frame_create (val, type, NULL, attr);
+            f = _parse_frame_create (c, val, type, NULL, attr);
             g_ptr_array_add (c->frames, f);
         }
     }
@@ -496,16 +1129,32 @@ static void _gimo_xml_start_element (void *data,
     }
 }
 
-static void _gimo_xml_end_element (void *data,
-                                   const char *el)
+static void _gimo_xml_start_element (void *data,
+                                     const char *el,
+                                     const char **attr)
 {
     struct _ParseContext *c = data;
-    struct _ParseFrame *f, *p;
+    guint len = c->frames->len;
 
-    if (c->frames->len != c->depth) {
-        --c->depth;
+    ++c->depth;
+
+    if (c->error)
         return;
-    }
+
+    _gimo_xml_push_element (c, el, attr);
+
+    /* The element and its children are skipped. */
+    if (c->frames->len == len)
+        _parse_plan_drop (c);
+}
+
+/*
+ * Finish the top frame, the object is created and given to the parent
+ * frame, or to the archive at the top level.
+ */
+static void _parse_frame_pop (struct _ParseContext *c)
+{
+    struct _ParseFrame *f, *p;
 
     f = g_ptr_array_index (c->frames, c->frames->len - 1);
     if (c->error || !f)
@@ -513,40 +1162,91 @@ static void _gimo_xml_end_element (void *data,
 
     if (f->klass) {
         GObject *obj;
-        GParameter *params;
-        guint nparam;
+        GParameter *params = NULL;
+        struct _ParseParam *it;
+        guint i;
+
+        _parse_plan_add (c, PLAN_OP_END, 0, NULL, NULL, NULL);
 
-        params = f->params ? (GParameter *) f->params->data : NULL;
-        nparam = f->params ? f->params->len : 0;
+        /* The params are listed in reverse order, the last value
+         * of a property wins as before. */
+        if (f->nparam > 0) {
+            params = _parse_arena_alloc (&c->arena,
+                                         f->nparam * sizeof (GParameter));
 
-        obj = g_object_newv (f->type, nparam, params);
+            for (i = f->nparam, it = f->params; it; it = it->next)
+                params[--i] = it->param;
+        }
+
+        obj = g_object_newv (f->type, f->nparam, params);
         if (NULL == obj) {
             g_warning ("XmlArchive new object failed: %s",
                        g_type_name (f->type));
+            _parse_plan_drop (c);
             goto done;
         }
 
         if (c->frames->len > 2) {
             p = g_ptr_array_index (c->frames, c->frames->len - 2);
-            _parse_frame_set_property (p, f->prop, obj, NULL, NULL);
+            _parse_frame_set_property (c, p, f->prop, obj, NULL, NULL);
         }
         else {
-            if (!gimo_archive_add_object (c->archive, f->id, obj))
+            if (!_gimo_archive_object_parsed (c->archive, f->id, obj))
                 c->error = TRUE;
         }
 
         g_object_unref (obj);
     }
     else if (f->obj_array) {
+        _parse_plan_add (c, PLAN_OP_END, 0, NULL, NULL, NULL);
+
         if (c->frames->len > 2) {
             p = g_ptr_array_index (c->frames, c->frames->len - 2);
-            _parse_frame_set_property (p, f->prop, f->obj_array, NULL, NULL);
+            _parse_frame_set_property (c, p, f->prop, f->obj_array, NULL, NULL);
         }
     }
+    else if (f->ref) {
+        p = g_ptr_array_index (c->frames, c->frames->len - 2);
+        _parse_frame_set_property (c, p, f->prop, f->ref, NULL, NULL);
+    }
 
 done:
+    if (f)
+        g_string_truncate (c->text, f->text_offset);
+
     g_ptr_array_remove_index (c->frames, c->frames->len - 1);
 
+    /* Back to the root, a top level object is done. */
+    if (1 == c->frames->len)
+        _parse_arena_reset (&c->arena);
+}
+
+static void _gimo_xml_end_element (void *data,
+                                   const char *el)
+{
+    struct _ParseContext *c = data;
+    struct _ParseFrame *f, *p;
+
+    if (c->frames->len != c->depth) {
+        --c->depth;
+        return;
+    }
+
+    f = g_ptr_array_index (c->frames, c->frames->len - 1);
+
+    /* A string element without text is the empty string. */
+    if (!c->error && f &&
+        (f->has_text || (f->prop && !f->klass && !f->obj_array && !f->ref &&
+                         G_TYPE_STRING == G_TYPE_FUNDAMENTAL (f->type))))
+    {
+        /* The whole text of the element is converted at once. */
+        p = g_ptr_array_index (c->frames, c->frames->len - 2);
+        _parse_frame_set_property (c, p, f->prop, NULL, NULL,
+                                   c->text->str + f->text_offset);
+    }
+
+    _parse_frame_pop (c);
+
     --c->depth;
 }
 
@@ -559,44 +1259,114 @@ static void _gimo_xml_handle_char (void *data,
     if (c->error)
         return;
 
-    if (c->frames->len > 2) {
-        struct _ParseFrame *p, *f;
+    /* Only the text directly in a scalar property element. */
+    if (c->frames->len > 2 && c->frames->len == c->depth) {
+        struct _ParseFrame *f;
 
-        p = g_ptr_array_index (c->frames, c->frames->len - 2);
         f = g_ptr_array_index (c->frames, c->frames->len - 1);
-        if (f->prop && !f->klass && !f->obj_array) {
-            gchar *str = g_strndup (txt, len);
-            _parse_frame_set_property (p, f->prop, NULL, NULL, str);
-            g_free (str);
+        if (f->prop && !f->klass && !f->obj_array && !f->ref) {
+            g_string_append_len (c->text, txt, len);
+            f->has_text = TRUE;
         }
     }
 }
 
-static gboolean _gimo_xmlarchive_read (GimoArchive *self,
-                                       const gchar *file_name)
+/* Build the objects of a cached plan, the same as the parse does. */
+static gboolean _parse_plan_replay (GimoArchive *self,
+                                    struct _ParsePlan *plan)
+{
+    static const gchar *no_attr[] = { NULL };
+    struct _ParseContext *c;
+    struct _ParseFrame *f;
+    struct _PlanOp *op;
+    GObject *object;
+    GValue value;
+    gboolean error;
+    guint i;
+
+    c = _parse_context_create (self);
+    g_ptr_array_add (c->frames, NULL);
+
+    for (i = 0; i < plan->ops->len && !c->error; ++i) {
+        op = &g_array_index (plan->ops, struct _PlanOp, i);
+
+        switch (op->kind) {
+        case PLAN_OP_BEGIN:
+            f = _parse_frame_create (c, op->id, op->type, op->prop, no_attr);
+            g_ptr_array_add (c->frames, f);
+            break;
+
+        case PLAN_OP_VALUE:
+            f = g_ptr_array_index (c->frames, c->frames->len - 1);
+            memset (&value, 0, sizeof (value));
+            g_value_init (&value, G_VALUE_TYPE (&op->value));
+            g_value_copy (&op->value, &value);
+            _parse_frame_add_param (c, f, op->prop->name, &value);
+            break;
+
+        case PLAN_OP_REF:
+            object = _parse_resolve_ref (c, op->id, op->type);
+            if (object) {
+                f = g_ptr_array_index (c->frames, c->frames->len - 1);
+                _parse_frame_set_property (c, f, op->prop, object, NULL, NULL);
+                g_object_unref (object);
+            }
+            break;
+
+        case PLAN_OP_END:
+            _parse_frame_pop (c);
+            break;
+
+        default:
+            g_assert_not_reached ();
+        }
+    }
+
+    error = c->error;
+    _parse_context_destroy (c);
+
+    return !error;
+}
+
+/*
+ * Parse the whole content with as few XML_Parse () calls as possible,
+ * expat takes an int length, so only huge data is split.
+ */
+static gboolean _gimo_xmlarchive_parse (GimoArchive *self,
+                                        const gchar *data,
+                                        gsize length)
 {
-    FILE *fp;
-    char buf[1024];
-    size_t len;
-    int done;
-    int status;
     XML_Parser parser;
     struct _ParseContext *context;
-    gchar *local_name;
+    struct _ParsePlan *plan;
+    int status = XML_STATUS_OK;
+    gchar *key = NULL;
+    gsize len;
+    gboolean done;
     gboolean error;
 
-    local_name = g_locale_from_utf8 (file_name, -1, NULL, NULL, NULL);
-    fp = fopen (local_name, "rb");
-    g_free (local_name);
-
-    if (NULL == fp)
-        gimo_set_error_return_val (GIMO_ERROR_OPEN_FILE, FALSE);
+    if (g_atomic_int_get (&plan_cache_size) > 0) {
+        key = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+                                           (const guchar *) data,
+                                           length);
+
+        plan = _parse_plan_cache_lookup (key);
+        if (plan) {
+            g_free (key);
+            error = !_parse_plan_replay (self, plan);
+            _parse_plan_unref (plan);
+            return !error;
+        }
+    }
 
     parser = XML_ParserCreate (NULL);
 
-    context = _parse_context_create (GIMO_ARCHIVE (self));
+    context = _parse_context_create (self);
     XML_SetUserData (parser, context);
 
+    if (key)
+        context->plan = _plan_ops_new ();
+
     XML_SetElementHandler (parser,
                            _gimo_xml_start_element,
                            _gimo_xml_end_element);
@@ -605,9 +1375,9 @@ static gboolean _gimo_xmlarchive_read (GimoArchive *self,
                                  _gimo_xml_handle_char);
 
     do {
-        len = fread (buf, 1, sizeof (buf), fp);
-        done = len < sizeof(buf);
-        status = XML_Parse (parser, buf, len, done);
+        len = MIN (length, G_MAXINT);
+        done = (len == length);
+        status = XML_Parse (parser, data, (int) len, done);
 
         if (XML_STATUS_ERROR == status) {
             gimo_set_error_full (GIMO_ERROR_LOAD,
@@ -620,90 +1390,648 @@ static gboolean _gimo_xmlarchive_read (GimoArchive *self,
 
         if (context->error)
             break;
+
+        data += len;
+        length -= len;
     } while (!done);
 
     error = context->error;
-    g_assert (context->frames->len == 0);
+
+    if (XML_STATUS_OK == status && !error && context->plan)
+        _parse_plan_cache_insert (key, context->plan);
+
     XML_ParserFree (parser);
     _parse_context_destroy (context);
-    fclose (fp);
+    g_free (key);
 
     return (XML_STATUS_OK == status) && !error;
 }
 
-static gboolean _gimo_xmlarchive_save (GimoArchive *self,
+static gboolean _gimo_xmlarchive_read (GimoArchive *self,
                                        const gchar *file_name)
 {
-    return FALSE;
+    GMappedFile *file;
+    gboolean result;
+
+    file = g_mapped_file_new (file_name, FALSE, NULL);
+    if (NULL == file)
+        gimo_set_error_return_val (GIMO_ERROR_OPEN_FILE, FALSE);
+
+    result = _gimo_xmlarchive_parse (self,
+                                     g_mapped_file_get_contents (file),
+                                     g_mapped_file_get_length (file));
+
+    g_mapped_file_unref (file);
+
+    return result;
 }
 
-static void gimo_loadable_interface_init (GimoLoadableInterface *iface)
+struct _WriteContext {
+    GOutputStream *stream;
+    GCancellable *cancellable;
+    GString *buffer;
+    GHashTable *ids;
+    gboolean compact;
+    gboolean error;
+};
+
+#define WRITE_FLUSH_SIZE 8192
+#define WRITE_MAX_DEPTH 64
+
+static gboolean _write_flush (struct _WriteContext *w,
+                              gboolean force)
 {
-    iface->load = (GimoLoadableLoadFunc) _gimo_xmlarchive_read;
+    GError *error = NULL;
+
+    if (w->error)
+        return FALSE;
+
+    if (!force && w->buffer->len < WRITE_FLUSH_SIZE)
+        return TRUE;
+
+    if (!g_output_stream_write_all (w->stream,
+                                    w->buffer->str,
+                                    w->buffer->len,
+                                    NULL,
+                                    w->cancellable,
+                                    &error))
+    {
+        gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                             "XmlArchive write error: %s",
+                             error->message);
+        g_error_free (error);
+        w->error = TRUE;
+        return FALSE;
+    }
+
+    g_string_truncate (w->buffer, 0);
+
+    return TRUE;
 }
 
-static void gimo_xmlarchive_init (GimoXmlArchive *self)
+static void _write_indent (struct _WriteContext *w,
+                           gint depth)
 {
+    if (w->compact)
+        return;
+
+    g_string_append_c (w->buffer, '\n');
+
+    while (depth-- > 0)
+        g_string_append (w->buffer, "  ");
 }
 
-static void gimo_xmlarchive_finalize (GObject *gobject)
+static void _write_escaped (struct _WriteContext *w,
+                            const gchar *text)
 {
-    G_OBJECT_CLASS (gimo_xmlarchive_parent_class)->finalize (gobject);
+    gchar *escaped;
+
+    escaped = g_markup_escape_text (text, -1);
+    g_string_append (w->buffer, escaped);
+    g_free (escaped);
 }
 
-static void gimo_xmlarchive_class_init (GimoXmlArchiveClass *klass)
+/*
+ * Whether a property is written, it must be set back by the reader,
+ * and a default value needs not be written.
+ */
+static gboolean _write_need_property (GParamSpec *prop,
+                                      GValue *value)
 {
-    GObjectClass *gobject_class;
-    GimoArchiveClass *archive_class;
+    if ((prop->flags & (G_PARAM_READABLE | G_PARAM_WRITABLE)) !=
+        (G_PARAM_READABLE | G_PARAM_WRITABLE))
+    {
+        return FALSE;
+    }
 
-    gobject_class = G_OBJECT_CLASS (klass);
-    archive_class = GIMO_ARCHIVE_CLASS (klass);
+    return !g_param_value_defaults (prop, value);
+}
 
-    gobject_class->finalize = gimo_xmlarchive_finalize;
+static gboolean _write_is_scalar (GType type)
+{
+    switch (G_TYPE_FUNDAMENTAL (type)) {
+    case G_TYPE_STRING:
+    case G_TYPE_BOOLEAN:
+    case G_TYPE_CHAR:
+    case G_TYPE_UCHAR:
+    case G_TYPE_INT:
+    case G_TYPE_UINT:
+    case G_TYPE_LONG:
+    case G_TYPE_ULONG:
+    case G_TYPE_INT64:
+    case G_TYPE_UINT64:
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+    case G_TYPE_ENUM:
+    case G_TYPE_FLAGS:
+        return TRUE;
+
+    default:
+        return FALSE;
+    }
+}
 
-    archive_class->read = _gimo_xmlarchive_read;
-    archive_class->save = _gimo_xmlarchive_save;
+/* The text form of a scalar, as _gimo_xml_convert_value () reads. */
+static void _write_scalar (struct _WriteContext *w,
+                           const GValue *value)
+{
+    GType type = G_VALUE_TYPE (value);
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    switch (G_TYPE_FUNDAMENTAL (type)) {
+    case G_TYPE_STRING:
+        _write_escaped (w, g_value_get_string (value));
+        break;
+
+    case G_TYPE_BOOLEAN:
+        g_string_append (w->buffer,
+                         g_value_get_boolean (value) ? "TRUE" : "FALSE");
+        break;
+
+    case G_TYPE_CHAR:
+        g_string_append_printf (w->buffer, "%d",
+                                (gint) g_value_get_schar (value));
+        break;
+
+    case G_TYPE_UCHAR:
+        g_string_append_printf (w->buffer, "%u",
+                                (guint) g_value_get_uchar (value));
+        break;
+
+    case G_TYPE_INT:
+        g_string_append_printf (w->buffer, "%d", g_value_get_int (value));
+        break;
+
+    case G_TYPE_UINT:
+        g_string_append_printf (w->buffer, "%u", g_value_get_uint (value));
+        break;
+
+    case G_TYPE_LONG:
+        g_string_append_printf (w->buffer, "%ld", g_value_get_long (value));
+        break;
+
+    case G_TYPE_ULONG:
+        g_string_append_printf (w->buffer, "%lu", g_value_get_ulong (value));
+        break;
+
+    case G_TYPE_INT64:
+        g_string_append_printf (w->buffer, "%" G_GINT64_FORMAT,
+                                g_value_get_int64 (value));
+        break;
+
+    case G_TYPE_UINT64:
+        g_string_append_printf (w->buffer, "%" G_GUINT64_FORMAT,
+                                g_value_get_uint64 (value));
+        break;
+
+    case G_TYPE_FLOAT:
+        g_string_append (w->buffer,
+                         g_ascii_dtostr (buf, sizeof (buf),
+                                         g_value_get_float (value)));
+        break;
+
+    case G_TYPE_DOUBLE:
+        g_string_append (w->buffer,
+                         g_ascii_dtostr (buf, sizeof (buf),
+                                         g_value_get_double (value)));
+        break;
+
+    case G_TYPE_ENUM:
+        {
+            GEnumValue *enum_value;
+            gint v = g_value_get_enum (value);
+
+            enum_value = g_enum_get_value (g_type_class_peek (type), v);
+            if (enum_value)
+                g_string_append (w->buffer, enum_value->value_name);
+            else
+                g_string_append_printf (w->buffer, "%d", v);
+        }
+        break;
+
+    case G_TYPE_FLAGS:
+        {
+            GFlagsClass *klass = g_type_class_peek (type);
+            GFlagsValue *flags_value;
+            guint v = g_value_get_flags (value);
+            gboolean first = TRUE;
+
+            while (v) {
+                flags_value = g_flags_get_first_value (klass, v);
+                if (NULL == flags_value || 0 == flags_value->value)
+                    break;
+
+                if (!first)
+                    g_string_append (w->buffer, " | ");
+
+                g_string_append (w->buffer, flags_value->value_name);
+                v &= ~flags_value->value;
+                first = FALSE;
+            }
+
+            if (v || first) {
+                if (!first)
+                    g_string_append (w->buffer, " | ");
+
+                g_string_append_printf (w->buffer, "%u", v);
+            }
+        }
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+/*
+ * A scalar is written as attribute in compact form, except the names
+ * the reader takes for itself and text that attributes can't keep.
+ */
+static gboolean _write_as_attribute (struct _WriteContext *w,
+                                     GParamSpec *prop,
+                                     const GValue *value)
+{
+    const gchar *str;
+
+    if (!w->compact)
+        return FALSE;
+
+    /* The reader takes these attributes as the object's own. */
+    if (strcmp (prop->name, "id") == 0 ||
+        strcmp (prop->name, "class") == 0 ||
+        strcmp (prop->name, "ref") == 0)
+    {
+        return FALSE;
+    }
+
+    if (G_VALUE_HOLDS_STRING (value)) {
+        str = g_value_get_string (value);
+
+        if (strpbrk (str, "\t\n\r"))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void _write_object (struct _WriteContext *w,
+                           const gchar *tag,
+                           const gchar *id,
+                           GObject *object,
+                           GType declared_type,
+                           gint depth);
+
+/*
+ * An object already written with an identifier is referenced, the
+ * reader resolves it against the objects read before.
+ */
+static gboolean _write_ref (struct _WriteContext *w,
+                            const gchar *tag,
+                            GObject *object,
+                            gint depth)
+{
+    const gchar *id;
+
+    id = g_hash_table_lookup (w->ids, object);
+    if (NULL == id)
+        return FALSE;
+
+    _write_indent (w, depth);
+    g_string_append_printf (w->buffer, "<%s ref=\"", tag);
+    _write_escaped (w, id);
+    g_string_append (w->buffer, "\"/>");
+
+    return TRUE;
+}
+
+static void _write_property (struct _WriteContext *w,
+                             GParamSpec *prop,
+                             const GValue *value,
+                             gint depth)
+{
+    GType type = G_PARAM_SPEC_VALUE_TYPE (prop);
+
+    if (_write_is_scalar (type)) {
+        _write_indent (w, depth);
+        g_string_append_printf (w->buffer, "<%s>", prop->name);
+        _write_scalar (w, value);
+        g_string_append_printf (w->buffer, "</%s>", prop->name);
+    }
+    else if (G_TYPE_IS_OBJECT (type)) {
+        if (_write_ref (w, prop->name, g_value_get_object (value), depth))
+            return;
+
+        _write_object (w,
+                       prop->name,
+                       NULL,
+                       g_value_get_object (value),
+                       type,
+                       depth);
+    }
+    else if (GIMO_TYPE_OBJECT_ARRAY == type) {
+        GPtrArray *array = g_value_get_boxed (value);
+        guint i;
+
+        _write_indent (w, depth);
+
+        if (0 == array->len) {
+            g_string_append_printf (w->buffer, "<%s/>", prop->name);
+            return;
+        }
+
+        g_string_append_printf (w->buffer, "<%s>", prop->name);
+
+        for (i = 0; i < array->len && !w->error; ++i) {
+            if (_write_ref (w, "object", g_ptr_array_index (array, i),
+                            depth + 1))
+            {
+                continue;
+            }
+
+            _write_object (w,
+                           "object",
+                           NULL,
+                           g_ptr_array_index (array, i),
+                           G_TYPE_INVALID,
+                           depth + 1);
+        }
+
+        _write_indent (w, depth);
+        g_string_append_printf (w->buffer, "</%s>", prop->name);
+    }
+}
+
+/*
+ * Write an object element, the class attribute is written if the
+ * reader can't know the type from the element.
+ */
+static void _write_object (struct _WriteContext *w,
+                           const gchar *tag,
+                           const gchar *id,
+                           GObject *object,
+                           GType declared_type,
+                           gint depth)
+{
+    GParamSpec **props;
+    GValue *values;
+    gboolean *elements;
+    gboolean has_elements = FALSE;
+    guint i, count;
+    GType type;
+
+    if (w->error)
+        return;
+
+    if (depth > WRITE_MAX_DEPTH) {
+        gimo_set_error_full (GIMO_ERROR_INVALID_OBJECT,
+                             "XmlArchive object too deep: %s",
+                             G_OBJECT_TYPE_NAME (object));
+        w->error = TRUE;
+        return;
+    }
+
+    type = G_OBJECT_TYPE (object);
+
+    _write_indent (w, depth);
+    g_string_append_printf (w->buffer, "<%s", tag);
+
+    if (type != declared_type)
+        g_string_append_printf (w->buffer, " class=\"%s\"", g_type_name (type));
+
+    if (id) {
+        g_string_append (w->buffer, " id=\"");
+        _write_escaped (w, id);
+        g_string_append_c (w->buffer, '"');
+    }
+
+    props = g_object_class_list_properties (G_OBJECT_GET_CLASS (object),
+                                            &count);
+    values = g_new0 (GValue, count);
+    elements = g_new0 (gboolean, count);
+
+    for (i = 0; i < count; ++i) {
+        GType value_type = G_PARAM_SPEC_VALUE_TYPE (props[i]);
+
+        if (!(props[i]->flags & G_PARAM_READABLE))
+            continue;
+
+        g_value_init (values + i, value_type);
+        g_object_get_property (object, props[i]->name, values + i);
+
+        if (!_write_need_property (props[i], values + i) ||
+            (G_VALUE_HOLDS_STRING (values + i) &&
+             NULL == g_value_get_string (values + i)))
+        {
+            g_value_unset (values + i);
+            continue;
+        }
+
+        if (!_write_is_scalar (value_type) &&
+            !G_TYPE_IS_OBJECT (value_type) &&
+            value_type != GIMO_TYPE_OBJECT_ARRAY)
+        {
+            /* The value would be lost, the reader can't set it. */
+            g_warning ("XmlArchive unsupported property type: %s.%s: %s",
+                       G_OBJECT_TYPE_NAME (object),
+                       props[i]->name,
+                       g_type_name (value_type));
+            g_value_unset (values + i);
+            continue;
+        }
+
+        if (_write_is_scalar (value_type) &&
+            _write_as_attribute (w, props[i], values + i))
+        {
+            g_string_append_printf (w->buffer, " %s=\"", props[i]->name);
+            _write_scalar (w, values + i);
+            g_string_append_c (w->buffer, '"');
+        }
+        else {
+            elements[i] = TRUE;
+            has_elements = TRUE;
+        }
+    }
+
+    if (has_elements) {
+        g_string_append_c (w->buffer, '>');
 
-    /* Register value transformation functions. */
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_CHAR,
-                                     _value_transform_string_int);
+        for (i = 0; i < count; ++i) {
+            if (elements[i])
+                _write_property (w, props[i], values + i, depth + 1);
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_UCHAR,
-                                     _value_transform_string_uint);
+            _write_flush (w, FALSE);
+        }
+
+        _write_indent (w, depth);
+        g_string_append_printf (w->buffer, "</%s>", tag);
+    }
+    else {
+        g_string_append (w->buffer, "/>");
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (G_IS_VALUE (values + i))
+            g_value_unset (values + i);
+    }
+
+    g_free (elements);
+    g_free (values);
+    g_free (props);
+
+    _write_flush (w, FALSE);
+}
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_BOOLEAN,
-                                     _value_transform_string_bool);
+static gboolean _gimo_xmlarchive_write_object (gpointer key,
+                                               gpointer value,
+                                               gpointer data)
+{
+    struct _WriteContext *w = data;
+
+    _write_object (w, "object", key, value, G_TYPE_INVALID, 1);
+
+    /* The identifier lives until the foreach returns. */
+    if (key && !g_hash_table_contains (w->ids, value))
+        g_hash_table_insert (w->ids, value, key);
+
+    return w->error;
+}
+
+/**
+ * gimo_xmlarchive_write:
+ * @self: a #GimoXmlArchive
+ * @stream: the output stream
+ * @compact: whether to write scalar properties as attributes
+ *           without indentation
+ * @cancellable: (allow-none): a #GCancellable
+ *
+ * Write the objects of the archive to a stream, the readable and
+ * writable properties which are not default are written, including
+ * objects and object arrays. Both forms can be read back.
+ *
+ * An object written before with an identifier is written as a
+ * <literal>ref</literal> to it when met again, other objects are
+ * written in full wherever they are met. A property of a type the
+ * reader can't set is skipped with a warning.
+ *
+ * Returns: whether the archive is written
+ */
+gboolean gimo_xmlarchive_write (GimoXmlArchive *self,
+                                GOutputStream *stream,
+                                gboolean compact,
+                                GCancellable *cancellable)
+{
+    struct _WriteContext w;
+
+    g_return_val_if_fail (GIMO_IS_XMLARCHIVE (self), FALSE);
+    g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+
+    w.stream = stream;
+    w.cancellable = cancellable;
+    w.buffer = g_string_sized_new (WRITE_FLUSH_SIZE);
+    w.ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+    w.compact = compact;
+    w.error = FALSE;
+
+    g_string_append (w.buffer,
+                     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<archive version=\"1.0\">");
+
+    gimo_archive_foreach (GIMO_ARCHIVE (self),
+                          _gimo_xmlarchive_write_object,
+                          &w);
+
+    if (!compact)
+        g_string_append_c (w.buffer, '\n');
+
+    g_string_append (w.buffer, "</archive>\n");
+
+    _write_flush (&w, TRUE);
+    g_string_free (w.buffer, TRUE);
+    g_hash_table_unref (w.ids);
+
+    return !w.error;
+}
+
+static gboolean _gimo_xmlarchive_save (GimoArchive *self,
+                                       const gchar *file_name)
+{
+    GFile *file;
+    GFileOutputStream *stream;
+    GCancellable *cancellable;
+    GError *error = NULL;
+    gboolean result;
+
+    file = g_file_new_for_path (file_name);
+    stream = g_file_replace (file, NULL, FALSE,
+                             G_FILE_CREATE_NONE,
+                             NULL, &error);
+    g_object_unref (file);
+
+    if (NULL == stream) {
+        gimo_set_error_full (GIMO_ERROR_OPEN_FILE,
+                             "XmlArchive open file error: %s",
+                             error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    result = gimo_xmlarchive_write (GIMO_XMLARCHIVE (self),
+                                    G_OUTPUT_STREAM (stream),
+                                    FALSE,
+                                    NULL);
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_INT,
-                                     _value_transform_string_int);
+    /* Closing a cancelled stream keeps the original file. */
+    cancellable = g_cancellable_new ();
+    if (!result)
+        g_cancellable_cancel (cancellable);
+
+    if (!g_output_stream_close (G_OUTPUT_STREAM (stream),
+                                cancellable,
+                                &error))
+    {
+        if (result) {
+            gimo_set_error_full (GIMO_ERROR_INVALID_FILE,
+                                 "XmlArchive write error: %s",
+                                 error->message);
+            result = FALSE;
+        }
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_UINT,
-                                     _value_transform_string_uint);
+        g_error_free (error);
+    }
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_LONG,
-                                     _value_transform_string_long);
+    g_object_unref (cancellable);
+    g_object_unref (stream);
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_ULONG,
-                                     _value_transform_string_ulong);
+    return result;
+}
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_INT64,
-                                     _value_transform_string_int64);
+static void gimo_loadable_interface_init (GimoLoadableInterface *iface)
+{
+    iface->load = (GimoLoadableLoadFunc) _gimo_xmlarchive_read;
+}
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_UINT64,
-                                     _value_transform_string_uint64);
+static void gimo_xmlarchive_init (GimoXmlArchive *self)
+{
+}
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_FLOAT,
-                                     _value_transform_string_float);
+static void gimo_xmlarchive_finalize (GObject *gobject)
+{
+    G_OBJECT_CLASS (gimo_xmlarchive_parent_class)->finalize (gobject);
+}
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_DOUBLE,
-                                     _value_transform_string_double);
+static void gimo_xmlarchive_class_init (GimoXmlArchiveClass *klass)
+{
+    GObjectClass *gobject_class;
+    GimoArchiveClass *archive_class;
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_ENUM,
-                                     _value_transform_string_enum);
+    gobject_class = G_OBJECT_CLASS (klass);
+    archive_class = GIMO_ARCHIVE_CLASS (klass);
 
-    g_value_register_transform_func (G_TYPE_STRING, G_TYPE_FLAGS,
-                                     _value_transform_string_flags);
+    gobject_class->finalize = gimo_xmlarchive_finalize;
 
+    archive_class->read = _gimo_xmlarchive_read;
+    archive_class->save = _gimo_xmlarchive_save;
+    archive_class->read_data = _gimo_xmlarchive_parse;
 }
 
 GimoXmlArchive* gimo_xmlarchive_new (void)
@@ -711,6 +2039,31 @@ GimoXmlArchive* gimo_xmlarchive_new (void)
     return g_object_new (GIMO_TYPE_XMLARCHIVE, NULL);
 }
 
+/**
+ * gimo_xmlarchive_set_plan_cache_size:
+ * @size: the max number of cached plans, 0 to disable the cache
+ *
+ * Set the size of the process wide parse plan cache. An archive whose
+ * content hash is in the cache is built from the recorded plan without
+ * tokenizing or converting the values again. Archives with skipped
+ * content are never cached.
+ */
+void gimo_xmlarchive_set_plan_cache_size (guint size)
+{
+    G_LOCK (plan_cache_lock);
+
+    g_atomic_int_set (&plan_cache_size, size);
+    _parse_plan_cache_trim (size);
+
+    /* Only disabling the cache drops the table. */
+    if (0 == size && plan_cache) {
+        g_hash_table_unref (plan_cache);
+        plan_cache = NULL;
+    }
+
+    G_UNLOCK (plan_cache_lock);
+}
+
 static gboolean _gimo_xmlarchive_plugin_start (GimoPlugin *self)
 {
     GimoContext *context = NULL;
@@ -734,6 +2087,13 @@ static gboolean _gimo_xmlarchive_plugin_start (GimoPlugin *self)
         factory = gimo_factory_new ((GimoFactoryFunc) gimo_xmlarchive_new,
                                     NULL);
         result = gimo_loader_register (loader, "xml", factory);
+        if (!result)
+            break;
+
+        g_object_unref (factory);
+        factory = gimo_factory_new ((GimoFactoryFunc) gimo_bundlearchive_new,
+                                    NULL);
+        result = gimo_loader_register (loader, "bundle", factory);
     } while (0);
 
     if (factory)
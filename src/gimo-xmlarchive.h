@@ -22,6 +22,7 @@
 
 #include "gimo-archive.h"
 #include "gimo-loadable.h"
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -53,6 +54,13 @@ GType gimo_xmlarchive_get_type (void) G_GNUC_CONST;
 
 GimoXmlArchive* gimo_xmlarchive_new (void);
 
+gboolean gimo_xmlarchive_write (GimoXmlArchive *self,
+                                GOutputStream *stream,
+                                gboolean compact,
+                                GCancellable *cancellable);
+
+void gimo_xmlarchive_set_plan_cache_size (guint size);
+
 G_END_DECLS
 
 #endif /* __GIMO_XMLARCHIVE_H__ */
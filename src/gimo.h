@@ -33,6 +33,7 @@
 #include <gimo-factory.h>
 #include <gimo-loadable.h>
 #include <gimo-module.h>
+#include <gimo-builtin.h>
 #include <gimo-archive.h>
 #include <gimo-marshal.h>
 #include <gimo-utils.h>
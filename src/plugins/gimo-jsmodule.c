@@ -24,6 +24,7 @@
 #include "gimo-loader.h"
 #include "gimo-plugin.h"
 #include "gimo-utils.h"
+#include <gmodule.h>
 
 #include <gi/object.h>
 #include <gi/value.h>
@@ -405,3 +406,13 @@ GObject* gimo_jsmodule_plugin (GimoPlugin *plugin)
 
     return g_object_ref (plugin);
 }
+
+/*
+ * The loader keeps the gimo_jsmodule_new () factory and the context
+ * keeps the "call-gc" handler, so the module is never unloaded.
+ */
+G_MODULE_EXPORT const gchar* g_module_check_init (GModule *module)
+{
+    g_module_make_resident (module);
+    return NULL;
+}
@@ -24,6 +24,7 @@
 #include "gimo-loader.h"
 #include "gimo-plugin.h"
 #include "gimo-utils.h"
+#include <gmodule.h>
 
 /* Redefined in Python.h */
 #undef  _POSIX_C_SOURCE
@@ -455,3 +456,13 @@ GObject* gimo_pymodule_plugin (GimoPlugin *plugin)
 
     return g_object_ref (plugin);
 }
+
+/*
+ * The loader keeps the gimo_pymodule_new () factory after the plugin
+ * is gone, so the module is never unloaded.
+ */
+G_MODULE_EXPORT const gchar* g_module_check_init (GModule *module)
+{
+    g_module_make_resident (module);
+    return NULL;
+}
@@ -18,8 +18,10 @@
  * Boston, MA 02111-1307, USA.
  */
 #include "gimo-datastore.h"
+#include "gimo-dlmodule.h"
 #include "gimo-plugin.h"
 #include "gimo-signalbus.h"
+#include <gmodule.h>
 #include <string.h>
 
 #define TEST_TYPE_PLUGIN (test_plugin_get_type())
@@ -199,3 +201,36 @@ GObject* demo_plugin (GimoPlugin *plugin)
 
     return g_object_ref (plugin);
 }
+
+static GObject* _demo_plugin_object (GObject *param)
+{
+    return G_OBJECT (test_plugin_new ());
+}
+
+static const GimoModuleSymbol demo_plugin_symbols[] = {
+    { "demo_plugin_object", _demo_plugin_object },
+    { NULL, NULL }
+};
+
+static const GimoModuleDescriptor demo_plugin_descriptor = {
+    GIMO_MODULE_DESCRIPTOR_VERSION,
+    NULL,
+    NULL,
+    NULL,
+    demo_plugin_symbols
+};
+
+G_MODULE_EXPORT const GimoModuleDescriptor* gimo_module_descriptor (void)
+{
+    return &demo_plugin_descriptor;
+}
+
+/*
+ * The start handler connects to the context and its signal bus,
+ * which outlive the plugin, so the module must stay mapped.
+ */
+G_MODULE_EXPORT const gchar* g_module_check_init (GModule *module)
+{
+    g_module_make_resident (module);
+    return NULL;
+}
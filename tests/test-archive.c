@@ -17,7 +17,9 @@
  * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
  * Boston, MA 02111-1307, USA.
  */
+#include "gimo-bundlearchive.h"
 #include "gimo-xmlarchive.h"
+#include <glib/gstdio.h>
 #include <math.h>
 #include <string.h>
 
@@ -47,6 +49,7 @@ typedef struct _TestConfig {
     gfloat f;
     gdouble d;
     gchar *s;
+    gchar *r;
     GPtrArray *a;
     struct _TestConfig *o;
 } TestConfig;
@@ -88,7 +91,8 @@ enum {
     PROP_DOUBLE,
     PROP_STRING,
     PROP_OBJECT,
-    PROP_ARRAY
+    PROP_ARRAY,
+    PROP_REF
 };
 
 GType test_enum_get_type (void)
@@ -140,6 +144,7 @@ static void test_config_finalize (GObject *gobject)
     TestConfig *self = TEST_CONFIG (gobject);
 
     g_free (self->s);
+    g_free (self->r);
 
     if (self->a)
         g_ptr_array_unref (self->a);
@@ -222,6 +227,10 @@ static void test_config_set_property (GObject *object,
         self->a = g_value_dup_boxed (value);
         break;
 
+    case PROP_REF:
+        self->r = g_value_dup_string (value);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -300,6 +309,10 @@ static void test_config_get_property (GObject *object,
         g_value_set_boxed (value, self->a);
         break;
 
+    case PROP_REF:
+        g_value_set_string (value, self->r);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -444,13 +457,35 @@ static void test_config_class_init (TestConfigClass *klass)
                             G_PARAM_CONSTRUCT_ONLY |
                             G_PARAM_STATIC_STRINGS));
 
+    /* Not a reference, the compact writer must keep it an element. */
+    g_object_class_install_property (
+        gobject_class, PROP_REF,
+        g_param_spec_string ("ref", "ref", "ref",
+                             NULL,
+                             G_PARAM_READWRITE |
+                             G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS));
+
+}
+
+static gboolean _test_archive_count_named (gpointer key,
+                                           gpointer value,
+                                           gpointer data)
+{
+    guint *count = data;
+
+    if (key)
+        ++(*count);
+
+    return FALSE;
 }
 
 static void _test_archive_common (void)
 {
     GimoArchive *archive;
     GObject *object;
-    GPtrArray *array;
+    GPtrArray *array, *objects;
+    guint i, count;
 
     archive = gimo_archive_new ();
     object = G_OBJECT (gimo_archive_new ());
@@ -469,6 +504,38 @@ static void _test_archive_common (void)
     gimo_archive_remove_object (archive, "1");
     g_assert (!gimo_archive_query_object (archive, "1"));
     g_object_unref (archive);
+
+    /* Anonymous objects keep the insertion order. */
+    archive = gimo_archive_new ();
+    objects = g_ptr_array_new_with_free_func (g_object_unref);
+
+    for (i = 0; i < 12; ++i) {
+        object = G_OBJECT (gimo_archive_new ());
+        g_assert (gimo_archive_add_object (archive, NULL, object));
+        g_ptr_array_add (objects, object);
+    }
+
+    g_assert (gimo_archive_add_object (archive, "a", object));
+
+    array = gimo_archive_query_objects (archive);
+    g_assert (array->len == 13);
+
+    for (i = 0; i < objects->len; ++i)
+        g_assert (g_ptr_array_index (array, i) == g_ptr_array_index (objects, i));
+
+    g_ptr_array_unref (array);
+
+    count = 0;
+    gimo_archive_foreach (archive, _test_archive_count_named, &count);
+    g_assert (1 == count);
+
+    gimo_archive_remove_object (archive, "a");
+    array = gimo_archive_query_objects (archive);
+    g_assert (array->len == 12);
+    g_ptr_array_unref (array);
+
+    g_ptr_array_unref (objects);
+    g_object_unref (archive);
 }
 
 static void _test_config_default (TestConfig *config)
@@ -525,6 +592,7 @@ static void _test_archive_xml (void)
     g_assert (0 == config->o->i8);
     g_assert (TEST_ENUM_2 == config->o->venum);
     g_assert (TEST_FLAG_2 == config->o->vflags);
+    g_assert (strcmp (config->o->r, "config2") == 0);
 
     obj = g_ptr_array_index (config->a, 0);
     _test_config_default (obj);
@@ -537,6 +605,7 @@ static void _test_archive_xml (void)
     g_assert (-123 == obj->i8);
     g_assert (0 == obj->venum);
     g_assert ((TEST_FLAG_2 | TEST_FLAG_3) == obj->vflags);
+    g_assert (strcmp (obj->r, "config2") == 0);
 
     g_object_unref (config);
 
@@ -549,12 +618,478 @@ static void _test_archive_xml (void)
     g_object_unref (archive);
 }
 
+static void _test_archive_data (void)
+{
+    static const gchar data[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"config\" int=\"42\">"
+        "<string>mem&amp;ory</string>"
+        "</object>"
+        "</archive>";
+    static const gchar nicks[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"config\" enum=\"ENUM2\">"
+        "<flags>FLAG1 | 4</flags>"
+        "<int64> -7</int64>"
+        "<double>2.5</double>"
+        "</object>"
+        "</archive>";
+    GimoArchive *archive;
+    TestConfig *config;
+    GBytes *bytes;
+
+    archive = gimo_archive_new ();
+    g_assert (!gimo_archive_read_data (archive, data, strlen (data)));
+    g_object_unref (archive);
+
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read_data (archive, data, strlen (data)));
+    config = TEST_CONFIG (gimo_archive_query_object (archive, "config"));
+    g_assert (config);
+    g_assert (42 == config->i32);
+    /* Text split by the entity is one value */
+    g_assert (strcmp (config->s, "mem&ory") == 0);
+    g_object_unref (config);
+    g_object_unref (archive);
+
+    /* Truncated content */
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (!gimo_archive_read_data (archive, data, 20));
+    g_object_unref (archive);
+
+    /* Nicks and numbers, without touching the global transforms */
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read_data (archive, nicks, strlen (nicks)));
+    config = TEST_CONFIG (gimo_archive_query_object (archive, "config"));
+    g_assert (config);
+    g_assert (TEST_ENUM_2 == config->venum);
+    g_assert ((TEST_FLAG_1 | TEST_FLAG_3) == config->vflags);
+    g_assert (-7 == config->i64);
+    g_assert (fabs (config->d - 2.5) < 0.0001);
+    g_object_unref (config);
+    g_object_unref (archive);
+    g_assert (!g_value_type_transformable (G_TYPE_STRING, G_TYPE_INT));
+
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    bytes = g_bytes_new_static (data, strlen (data));
+    g_assert (gimo_archive_read_bytes (archive, bytes));
+    g_bytes_unref (bytes);
+    config = TEST_CONFIG (gimo_archive_query_object (archive, "config"));
+    g_assert (config && 42 == config->i32);
+    g_object_unref (config);
+    g_object_unref (archive);
+}
+
+static gboolean _test_archive_object_parsed (GimoArchive *archive,
+                                             const gchar *id,
+                                             GObject *object,
+                                             gpointer user_data)
+{
+    guint *count = user_data;
+
+    g_assert (TEST_CONFIG (object));
+    ++(*count);
+
+    /* Take config2 only */
+    return g_strcmp0 (id, "config2") == 0;
+}
+
+static void _test_archive_stream (void)
+{
+    GimoArchive *archive;
+    GObject *object;
+    guint count = 0;
+
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_signal_connect (archive,
+                      "object-parsed",
+                      G_CALLBACK (_test_archive_object_parsed),
+                      &count);
+    g_assert (gimo_archive_read (archive,
+                                 TEST_TOP_SRCDIR "demo-archive1.xml"));
+    g_assert (2 == count);
+
+    object = gimo_archive_query_object (archive, "config1");
+    g_assert (object);
+    g_object_unref (object);
+    g_assert (!gimo_archive_query_object (archive, "config2"));
+    g_object_unref (archive);
+}
+
+static void _test_config_equal (TestConfig *a, TestConfig *b)
+{
+    guint i;
+
+    g_assert (a->i8 == b->i8);
+    g_assert (a->u8 == b->u8);
+    g_assert (a->b == b->b);
+    g_assert (a->i32 == b->i32);
+    g_assert (a->u32 == b->u32);
+    g_assert (a->l32 == b->l32);
+    g_assert (a->ul32 == b->ul32);
+    g_assert (a->i64 == b->i64);
+    g_assert (a->u64 == b->u64);
+    g_assert (a->venum == b->venum);
+    g_assert (a->vflags == b->vflags);
+    g_assert (a->f == b->f);
+    g_assert (a->d == b->d);
+    g_assert (g_strcmp0 (a->s, b->s) == 0);
+    g_assert (g_strcmp0 (a->r, b->r) == 0);
+    g_assert (!a->o == !b->o);
+    g_assert (!a->a == !b->a);
+
+    if (a->o)
+        _test_config_equal (a->o, b->o);
+
+    if (a->a) {
+        g_assert (a->a->len == b->a->len);
+
+        for (i = 0; i < a->a->len; ++i) {
+            _test_config_equal (g_ptr_array_index (a->a, i),
+                                g_ptr_array_index (b->a, i));
+        }
+    }
+}
+
+static void _test_archive_write (gboolean compact)
+{
+    GimoArchive *archive, *copy;
+    GOutputStream *stream;
+    TestConfig *config, *config2;
+    const gchar *ids[] = { "config1", "config2" };
+    gchar *file_name;
+    guint i;
+
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read (archive,
+                                 TEST_TOP_SRCDIR "demo-archive1.xml"));
+
+    stream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+    g_assert (gimo_xmlarchive_write (GIMO_XMLARCHIVE (archive),
+                                     stream, compact, NULL));
+    g_assert (g_output_stream_close (stream, NULL, NULL));
+
+    copy = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read_data (
+        copy,
+        g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream)),
+        g_memory_output_stream_get_data_size (
+            G_MEMORY_OUTPUT_STREAM (stream))));
+    g_object_unref (stream);
+
+    for (i = 0; i < G_N_ELEMENTS (ids); ++i) {
+        config = TEST_CONFIG (gimo_archive_query_object (archive, ids[i]));
+        config2 = TEST_CONFIG (gimo_archive_query_object (copy, ids[i]));
+        g_assert (config && config2);
+        _test_config_equal (config, config2);
+        g_object_unref (config);
+        g_object_unref (config2);
+    }
+
+    g_object_unref (copy);
+
+    /* Save to file and read back */
+    file_name = g_build_filename (g_get_tmp_dir (), "test-archive.xml", NULL);
+    g_assert (gimo_archive_save (archive, file_name));
+
+    copy = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read (copy, file_name));
+    config = TEST_CONFIG (gimo_archive_query_object (archive, "config1"));
+    config2 = TEST_CONFIG (gimo_archive_query_object (copy, "config1"));
+    _test_config_equal (config, config2);
+    g_object_unref (config);
+    g_object_unref (config2);
+    g_object_unref (copy);
+
+    g_unlink (file_name);
+    g_free (file_name);
+    g_object_unref (archive);
+}
+
+static void _test_archive_write_shared (gboolean compact)
+{
+    GimoArchive *archive, *copy;
+    GOutputStream *stream;
+    TestConfig *shared, *owner;
+    GPtrArray *array;
+    const gchar *data;
+    gsize size;
+
+    shared = g_object_new (TEST_TYPE_CONFIG, "int", 7, NULL);
+    array = g_ptr_array_new_with_free_func (g_object_unref);
+    g_ptr_array_add (array, g_object_ref (shared));
+    g_ptr_array_add (array, g_object_new (TEST_TYPE_CONFIG, NULL));
+    owner = g_object_new (TEST_TYPE_CONFIG,
+                          "string", "",
+                          "object", shared,
+                          "array", array,
+                          NULL);
+    g_ptr_array_unref (array);
+
+    archive = gimo_archive_new ();
+    g_assert (gimo_archive_add_object (archive, "shared", G_OBJECT (shared)));
+    g_assert (gimo_archive_add_object (archive, "owner", G_OBJECT (owner)));
+    g_object_unref (shared);
+    g_object_unref (owner);
+
+    stream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+    g_assert (gimo_xmlarchive_write (GIMO_XMLARCHIVE (archive),
+                                     stream, compact, NULL));
+    g_assert (g_output_stream_close (stream, NULL, NULL));
+    g_object_unref (archive);
+
+    data = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream));
+    size = g_memory_output_stream_get_data_size (
+        G_MEMORY_OUTPUT_STREAM (stream));
+    g_assert (g_strstr_len (data, size, "ref=\"shared\""));
+
+    /* The references are the same object, the empty string is kept. */
+    copy = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read_data (copy, data, size));
+    g_object_unref (stream);
+
+    shared = TEST_CONFIG (gimo_archive_query_object (copy, "shared"));
+    owner = TEST_CONFIG (gimo_archive_query_object (copy, "owner"));
+    g_assert (shared && owner);
+    g_assert (7 == shared->i32);
+    g_assert (owner->s && '\0' == owner->s[0]);
+    g_assert (owner->o == shared);
+    g_assert (owner->a && 2 == owner->a->len);
+    g_assert (g_ptr_array_index (owner->a, 0) == shared);
+    g_assert (g_ptr_array_index (owner->a, 1) != shared);
+    g_object_unref (shared);
+    g_object_unref (owner);
+    g_object_unref (copy);
+}
+
+static void _test_archive_plan (void)
+{
+    static const gchar skipped[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"config\" int=\"42\">"
+        "<unknown>1</unknown>"
+        "</object>"
+        "</archive>";
+    GimoArchive *archive, *copy;
+    TestConfig *config, *config2;
+    const gchar *ids[] = { "config1", "config2" };
+    guint i, count = 0;
+
+    gimo_xmlarchive_set_plan_cache_size (4);
+
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read (archive,
+                                 TEST_TOP_SRCDIR "demo-archive1.xml"));
+
+    /* Built from the recorded plan. */
+    copy = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_signal_connect (copy,
+                      "object-parsed",
+                      G_CALLBACK (_test_archive_object_parsed),
+                      &count);
+    g_assert (gimo_archive_read (copy,
+                                 TEST_TOP_SRCDIR "demo-archive1.xml"));
+    g_assert (2 == count);
+    g_assert (!gimo_archive_query_object (copy, "config2"));
+    g_object_unref (copy);
+
+    copy = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read (copy,
+                                 TEST_TOP_SRCDIR "demo-archive1.xml"));
+
+    for (i = 0; i < G_N_ELEMENTS (ids); ++i) {
+        config = TEST_CONFIG (gimo_archive_query_object (archive, ids[i]));
+        config2 = TEST_CONFIG (gimo_archive_query_object (copy, ids[i]));
+        g_assert (config && config2 && config != config2);
+        _test_config_equal (config, config2);
+        g_object_unref (config);
+        g_object_unref (config2);
+    }
+
+    g_object_unref (copy);
+    g_object_unref (archive);
+
+    /* Content with skipped elements is parsed every time. */
+    for (i = 0; i < 2; ++i) {
+        archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+        g_assert (gimo_archive_read_data (archive, skipped, strlen (skipped)));
+        config = TEST_CONFIG (gimo_archive_query_object (archive, "config"));
+        g_assert (config && 42 == config->i32);
+        g_object_unref (config);
+        g_object_unref (archive);
+    }
+
+    /* A single plan, each read evicts the other content's plan. */
+    gimo_xmlarchive_set_plan_cache_size (1);
+
+    for (i = 0; i < 4; ++i) {
+        GObject *object;
+
+        archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+        g_assert (gimo_archive_read (archive,
+                                     i % 2 ?
+                                     TEST_TOP_SRCDIR "demo-archive1.xml" :
+                                     TEST_TOP_SRCDIR "demo-archive2.xml"));
+        object = gimo_archive_query_object (archive,
+                                            i % 2 ? "config1" : "plugin1");
+        g_assert (object);
+        g_object_unref (object);
+        g_object_unref (archive);
+    }
+
+    gimo_xmlarchive_set_plan_cache_size (0);
+}
+
+static void _test_archive_ref (void)
+{
+    static const gchar data[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"local\" int=\"1\"/>"
+        "<object class=\"TestConfig\" id=\"config\">"
+        "<object ref=\"base\"/>"
+        "<array class=\"TestConfig\">"
+        "<config ref=\"local\"/>"
+        "<config ref=\"base\"/>"
+        "</array>"
+        "</object>"
+        "</archive>";
+    GimoArchive *shared, *archive;
+    TestConfig *base, *local, *config;
+    guint i;
+
+    shared = gimo_archive_new ();
+    base = g_object_new (TEST_TYPE_CONFIG, "int", 7, NULL);
+    g_assert (gimo_archive_add_object (shared, "base", G_OBJECT (base)));
+
+    /* The second read is replayed from the plan cache. */
+    gimo_xmlarchive_set_plan_cache_size (4);
+
+    for (i = 0; i < 2; ++i) {
+        archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+        gimo_archive_set_shared (archive, shared);
+        g_assert (gimo_archive_read_data (archive, data, strlen (data)));
+
+        local = TEST_CONFIG (gimo_archive_resolve_object (archive, "local"));
+        config = TEST_CONFIG (gimo_archive_resolve_object (archive, "config"));
+        g_assert (local && config);
+        g_assert (config->o == base);
+        g_assert (config->a && 2 == config->a->len);
+        g_assert (g_ptr_array_index (config->a, 0) == local);
+        g_assert (g_ptr_array_index (config->a, 1) == base);
+        g_object_unref (local);
+        g_object_unref (config);
+
+        config = TEST_CONFIG (gimo_archive_resolve_object (archive, "base"));
+        g_assert (config == base);
+        g_object_unref (config);
+        g_object_unref (archive);
+    }
+
+    gimo_xmlarchive_set_plan_cache_size (0);
+
+    /* Not resolved without the shared archive. */
+    archive = GIMO_ARCHIVE (gimo_xmlarchive_new ());
+    g_assert (gimo_archive_read_data (archive, data, strlen (data)));
+    config = TEST_CONFIG (gimo_archive_query_object (archive, "config"));
+    g_assert (config && !config->o);
+    g_assert (config->a && 1 == config->a->len);
+    g_object_unref (config);
+    g_object_unref (archive);
+
+    g_object_unref (base);
+    g_object_unref (shared);
+}
+
+static void _test_archive_bundle_ref (void)
+{
+    static const gchar base_data[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"base\" int=\"1\"/>"
+        "</archive>";
+    static const gchar use_data[] =
+        "<archive version=\"1.0\">"
+        "<object class=\"TestConfig\" id=\"use\">"
+        "<object ref=\"base\"/>"
+        "<array class=\"TestConfig\">"
+        "<config ref=\"outer\"/>"
+        "<config ref=\"test-bundle-base.xml\"/>"
+        "</array>"
+        "</object>"
+        "</archive>";
+    const gchar *tmp_dir = g_get_tmp_dir ();
+    GimoArchive *shared, *bundle, *entry;
+    TestConfig *outer, *base, *use;
+    GPtrArray *files;
+    gchar *base_file, *use_file, *file_name;
+
+    base_file = g_build_filename (tmp_dir, "test-bundle-base.xml", NULL);
+    use_file = g_build_filename (tmp_dir, "test-bundle-use.xml", NULL);
+    file_name = g_build_filename (tmp_dir, "test-bundle.bundle", NULL);
+    g_assert (g_file_set_contents (base_file, base_data, -1, NULL));
+    g_assert (g_file_set_contents (use_file, use_data, -1, NULL));
+
+    files = g_ptr_array_new ();
+    g_ptr_array_add (files, base_file);
+    g_ptr_array_add (files, use_file);
+    g_assert (gimo_bundlearchive_pack (file_name, tmp_dir, files));
+    g_ptr_array_unref (files);
+
+    shared = gimo_archive_new ();
+    outer = g_object_new (TEST_TYPE_CONFIG, "int", 7, NULL);
+    g_assert (gimo_archive_add_object (shared, "outer", G_OBJECT (outer)));
+
+    /* A reference reaches the objects of the earlier entries and
+     * the shared archive, but never an entry itself. */
+    bundle = GIMO_ARCHIVE (gimo_bundlearchive_new ());
+    gimo_archive_set_shared (bundle, shared);
+    g_assert (gimo_archive_read (bundle, file_name));
+
+    entry = GIMO_ARCHIVE (gimo_archive_query_object (bundle,
+                                                     "test-bundle-base.xml"));
+    g_assert (entry);
+    base = TEST_CONFIG (gimo_archive_query_object (entry, "base"));
+    g_assert (base && 1 == base->i32);
+    g_object_unref (entry);
+
+    entry = GIMO_ARCHIVE (gimo_archive_query_object (bundle,
+                                                     "test-bundle-use.xml"));
+    g_assert (entry);
+    use = TEST_CONFIG (gimo_archive_query_object (entry, "use"));
+    g_assert (use);
+    g_assert (use->o == base);
+    g_assert (use->a && 1 == use->a->len);
+    g_assert (g_ptr_array_index (use->a, 0) == outer);
+    g_object_unref (use);
+    g_object_unref (entry);
+
+    g_object_unref (base);
+    g_object_unref (bundle);
+    g_object_unref (outer);
+    g_object_unref (shared);
+
+    g_unlink (file_name);
+    g_unlink (use_file);
+    g_unlink (base_file);
+    g_free (file_name);
+    g_free (use_file);
+    g_free (base_file);
+}
+
 int main (int argc, char *argv[])
 {
     g_type_init ();
 
     _test_archive_common ();
     _test_archive_xml ();
+    _test_archive_data ();
+    _test_archive_stream ();
+    _test_archive_write (FALSE);
+    _test_archive_write (TRUE);
+    _test_archive_write_shared (FALSE);
+    _test_archive_write_shared (TRUE);
+    _test_archive_plan ();
+    _test_archive_ref ();
+    _test_archive_bundle_ref ();
 
     return 0;
 }
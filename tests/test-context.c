@@ -18,12 +18,15 @@
  * Boston, MA 02111-1307, USA.
  */
 #include "config.h"
+#include "gimo-builtin.h"
+#include "gimo-bundlearchive.h"
 #include "gimo-context.h"
 #include "gimo-datastore.h"
 #include "gimo-error.h"
 #include "gimo-extpoint.h"
 #include "gimo-loader.h"
 #include "gimo-plugin.h"
+#include <glib/gstdio.h>
 #include <string.h>
 
 struct _StateChange {
@@ -45,6 +48,29 @@ static void _test_context_state_changed (GimoContext *context,
     data->count++;
 }
 
+static gboolean _builtin_plugin_start (GimoPlugin *plugin)
+{
+    GimoContext *context = gimo_plugin_query_context (plugin);
+
+    gimo_bind_string (G_OBJECT (context), "builtin_start", "builtin_start");
+    g_object_unref (context);
+    return TRUE;
+}
+
+static GObject* builtin_plugin (GObject *param)
+{
+    g_signal_connect (param,
+                      "start",
+                      G_CALLBACK (_builtin_plugin_start),
+                      NULL);
+
+    return g_object_ref (param);
+}
+
+GIMO_BUILTIN_BEGIN (builtin_plugin)
+    GIMO_BUILTIN_SYMBOL (builtin_plugin)
+GIMO_BUILTIN_END (builtin_plugin, "builtin-plugin")
+
 static void _test_context_common (void)
 {
     GimoContext *context;
@@ -148,11 +174,86 @@ static guint _test_context_load_plugin (GimoContext *context,
     return count;
 }
 
+struct _ConcurrentSave {
+    GimoContext *context;
+    GimoDataStore *store;
+    GThread *thread;
+    GMutex mutex;
+    GCond cond;
+    gboolean started;
+    gboolean done;
+};
+
+static gpointer _test_context_save_thread (gpointer data)
+{
+    struct _ConcurrentSave *save = data;
+
+    g_mutex_lock (&save->mutex);
+    save->started = TRUE;
+    g_cond_signal (&save->cond);
+    g_mutex_unlock (&save->mutex);
+
+    gimo_context_save (save->context, save->store);
+
+    g_mutex_lock (&save->mutex);
+    save->done = TRUE;
+    g_mutex_unlock (&save->mutex);
+
+    return NULL;
+}
+
+/*
+ * Start a second save while the plugin is being saved, it must not
+ * finish before this handler returns.
+ */
+static void _test_context_plugin_save (GimoPlugin *plugin,
+                                       GimoDataStore *store,
+                                       struct _ConcurrentSave *save)
+{
+    if (save->thread)
+        return;
+
+    save->thread = g_thread_new ("save", _test_context_save_thread, save);
+
+    g_mutex_lock (&save->mutex);
+
+    while (!save->started)
+        g_cond_wait (&save->cond, &save->mutex);
+
+    g_mutex_unlock (&save->mutex);
+
+    /* Without the wait the thread takes the last checkpoint. */
+    g_usleep (G_USEC_PER_SEC / 10);
+
+    g_mutex_lock (&save->mutex);
+    g_assert (!save->done);
+    g_mutex_unlock (&save->mutex);
+}
+
+/* Save the context again from the handler on the same thread. */
+static void _test_context_plugin_resave (GimoPlugin *plugin,
+                                         GimoDataStore *store,
+                                         GimoDataStore **result)
+{
+    GimoContext *context;
+
+    if (*result)
+        return;
+
+    context = gimo_plugin_query_context (plugin);
+    *result = gimo_data_store_new ();
+    gimo_context_save (context, *result);
+    g_object_unref (context);
+}
+
 static void _test_context_dlplugin (void)
 {
     GimoContext *context;
+    GimoPlugin *plugin;
     GPtrArray *exts;
-    GimoDataStore *store;
+    GimoDataStore *store, *store2, *resaved;
+    struct _ConcurrentSave save;
+    gulong handler;
 
     context = gimo_context_new ();
     gimo_context_add_paths (context, TEST_PLUGIN_PATH);
@@ -203,11 +304,101 @@ static void _test_context_dlplugin (void)
     gimo_context_restore (context, store);
     g_object_unref (store);
     g_assert (gimo_lookup_string (G_OBJECT (context), "dl_update"));
+
+    /* Unchanged plugins reuse the last checkpoint. */
+    plugin = gimo_context_query_plugin (context, "org.gimo.test.plugin0");
+    g_assert (plugin && gimo_plugin_is_dirty (plugin));
+    store = gimo_data_store_new ();
+    gimo_context_save (context, store);
+    g_assert (!gimo_plugin_is_dirty (plugin));
+    store2 = gimo_data_store_new ();
+    gimo_context_save (context, store2);
+    g_assert (gimo_data_store_get_object (store, "org.gimo.test.plugin0") ==
+              gimo_data_store_get_object (store2, "org.gimo.test.plugin0"));
+    g_object_unref (store2);
+
+    gimo_plugin_mark_dirty (plugin);
+    store2 = gimo_data_store_new ();
+    gimo_context_save (context, store2);
+    g_assert (gimo_data_store_get_object (store, "org.gimo.test.plugin0") !=
+              gimo_data_store_get_object (store2, "org.gimo.test.plugin0"));
+    g_object_unref (store2);
+
+    /* A concurrent save waits for the fresh checkpoint. */
+    gimo_plugin_mark_dirty (plugin);
+    save.context = context;
+    save.store = gimo_data_store_new ();
+    save.thread = NULL;
+    g_mutex_init (&save.mutex);
+    g_cond_init (&save.cond);
+    save.started = FALSE;
+    save.done = FALSE;
+    handler = g_signal_connect (plugin,
+                                "save",
+                                G_CALLBACK (_test_context_plugin_save),
+                                &save);
+    store2 = gimo_data_store_new ();
+    gimo_context_save (context, store2);
+    g_signal_handler_disconnect (plugin, handler);
+    g_assert (save.thread);
+    g_thread_join (save.thread);
+    g_assert (gimo_data_store_get_object (store2, "org.gimo.test.plugin0") ==
+              gimo_data_store_get_object (save.store,
+                                          "org.gimo.test.plugin0"));
+    g_object_unref (save.store);
+    g_mutex_clear (&save.mutex);
+    g_cond_clear (&save.cond);
+
+    /* A nested save gets the last checkpoint instead of deadlock. */
+    gimo_plugin_mark_dirty (plugin);
+    resaved = NULL;
+    handler = g_signal_connect (plugin,
+                                "save",
+                                G_CALLBACK (_test_context_plugin_resave),
+                                &resaved);
+    g_object_unref (store);
+    store = gimo_data_store_new ();
+    gimo_context_save (context, store);
+    g_signal_handler_disconnect (plugin, handler);
+    g_assert (resaved);
+    g_assert (gimo_data_store_get_object (resaved,
+                                          "org.gimo.test.plugin0") ==
+              gimo_data_store_get_object (store2, "org.gimo.test.plugin0"));
+    g_assert (gimo_data_store_get_object (store, "org.gimo.test.plugin0") !=
+              gimo_data_store_get_object (store2, "org.gimo.test.plugin0"));
+    g_object_unref (resaved);
+    g_object_unref (store2);
+    g_object_unref (store);
+    g_object_unref (plugin);
+
     gimo_context_destroy (context);
     g_assert (gimo_lookup_string (G_OBJECT (context), "dl_stop"));
     g_object_unref (context);
 }
 
+/* The module of the manifest is served by the executable itself. */
+static void _test_context_builtin (void)
+{
+    GimoContext *context;
+    GimoPlugin *plugin;
+
+    context = gimo_context_new ();
+    gimo_context_add_paths (context, TEST_PLUGIN_PATH);
+
+    g_assert (_test_context_load_plugin (context,
+                                         "builtin-plugin.xml",
+                                         TRUE) == 1);
+    g_assert (gimo_lookup_string (G_OBJECT (context), "builtin_start"));
+
+    plugin = gimo_context_query_plugin (context, "org.gimo.test.builtin");
+    g_assert (plugin);
+    g_assert (GIMO_PLUGIN_ACTIVE == gimo_plugin_get_state (plugin));
+    g_object_unref (plugin);
+
+    gimo_context_destroy (context);
+    g_object_unref (context);
+}
+
 static void _test_context_jsplugin (void)
 {
     GimoContext *context;
@@ -306,13 +497,75 @@ static void _test_context_pyplugin (void)
     g_object_unref (context);
 }
 
+static void _test_context_bundle (void)
+{
+    GimoContext *context;
+    GPtrArray *files;
+    GPtrArray *plugins = NULL;
+    GimoPlugin *plugin;
+    gchar *file_name;
+
+    file_name = g_build_filename (g_get_tmp_dir (),
+                                  "test-context.bundle",
+                                  NULL);
+
+    files = g_ptr_array_new ();
+    g_ptr_array_add (files, "demo-plugin.xml");
+    g_ptr_array_add (files, "plugins/plugin1.xml");
+    g_assert (gimo_bundlearchive_pack (file_name, TEST_TOP_SRCDIR, files));
+    g_ptr_array_unref (files);
+
+    /* A standalone bundle keeps its entries without a cycle */
+    {
+        GimoArchive *archive;
+        GPtrArray *entries;
+
+        archive = GIMO_ARCHIVE (gimo_bundlearchive_new ());
+        g_assert (gimo_archive_read (archive, file_name));
+        entries = gimo_archive_query_objects (archive);
+        g_assert (entries && 2 == entries->len);
+        g_ptr_array_unref (entries);
+        g_object_add_weak_pointer (G_OBJECT (archive),
+                                   (gpointer *) &archive);
+        g_object_unref (archive);
+        g_assert (!archive);
+    }
+
+    context = gimo_context_new ();
+    gimo_context_add_paths (context, TEST_PLUGIN_PATH);
+
+    g_assert (gimo_context_load_plugin (context,
+                                        file_name,
+                                        FALSE,
+                                        NULL,
+                                        &plugins) == 2);
+    g_assert (plugins && 2 == plugins->len);
+    g_ptr_array_unref (plugins);
+
+    plugin = gimo_context_query_plugin (context, "org.gimo.test.plugin0");
+    g_assert (plugin);
+    g_object_unref (plugin);
+
+    plugin = gimo_context_query_plugin (context, "org.gimo.test.plugin1");
+    g_assert (plugin);
+    g_assert (g_str_has_suffix (gimo_plugin_get_path (plugin), "plugins"));
+    g_object_unref (plugin);
+
+    g_object_unref (context);
+
+    g_unlink (file_name);
+    g_free (file_name);
+}
+
 int main (int argc, char *argv[])
 {
     g_type_init ();
 
     _test_context_common ();
     _test_context_dlplugin ();
+    _test_context_builtin ();
     _test_context_jsplugin ();
+    _test_context_bundle ();
 
 #ifndef G_OS_WIN32
     /* FIXME: Win32 seems to have a deadlock. */
@@ -18,8 +18,278 @@
  * Boston, MA 02111-1307, USA.
  */
 #include "gimo-datastore.h"
+#include <glib/gstdio.h>
 #include <string.h>
 
+static void _test_data_store_check (GimoDataStore *store)
+{
+    GimoDataStore *child;
+    const GValue *value;
+
+    g_assert (strcmp (gimo_data_store_get_string (store, "string"),
+                      "hello") == 0);
+
+    value = gimo_data_store_get (store, "int");
+    g_assert (value && G_VALUE_HOLDS_INT (value));
+    g_assert (-42 == g_value_get_int (value));
+
+    value = gimo_data_store_get (store, "uint64");
+    g_assert (value && G_VALUE_HOLDS_UINT64 (value));
+    g_assert (G_MAXUINT64 == g_value_get_uint64 (value));
+
+    value = gimo_data_store_get (store, "boolean");
+    g_assert (value && g_value_get_boolean (value));
+
+    value = gimo_data_store_get (store, "double");
+    g_assert (value && 0.5 == g_value_get_double (value));
+
+    child = GIMO_DATASTORE (gimo_data_store_get_object (store, "child"));
+    g_assert (child);
+    g_assert (strcmp (gimo_data_store_get_string (child, "name"),
+                      "nested") == 0);
+}
+
+static void _test_data_store_serialize (void)
+{
+    GimoDataStore *store, *child, *copy;
+    GValue value = G_VALUE_INIT;
+    GVariant *variant;
+    gchar *file_name;
+
+    store = gimo_data_store_new ();
+    gimo_data_store_set_string (store, "string", "hello");
+
+    g_value_init (&value, G_TYPE_INT);
+    g_value_set_int (&value, -42);
+    gimo_data_store_set (store, "int", &value);
+    g_value_unset (&value);
+
+    g_value_init (&value, G_TYPE_UINT64);
+    g_value_set_uint64 (&value, G_MAXUINT64);
+    gimo_data_store_set (store, "uint64", &value);
+    g_value_unset (&value);
+
+    g_value_init (&value, G_TYPE_BOOLEAN);
+    g_value_set_boolean (&value, TRUE);
+    gimo_data_store_set (store, "boolean", &value);
+    g_value_unset (&value);
+
+    g_value_init (&value, G_TYPE_DOUBLE);
+    g_value_set_double (&value, 0.5);
+    gimo_data_store_set (store, "double", &value);
+    g_value_unset (&value);
+
+    child = gimo_data_store_new ();
+    gimo_data_store_set_string (child, "name", "nested");
+    gimo_data_store_set_object (store, "child", G_OBJECT (child));
+    g_object_unref (child);
+
+    variant = g_variant_ref_sink (gimo_data_store_serialize (store));
+    g_assert (g_variant_is_of_type (variant, G_VARIANT_TYPE_VARDICT));
+
+    copy = gimo_data_store_new ();
+    g_assert (gimo_data_store_deserialize (copy, variant));
+    g_variant_unref (variant);
+    _test_data_store_check (copy);
+    g_object_unref (copy);
+
+    variant = g_variant_new_int32 (1);
+    g_variant_ref_sink (variant);
+    copy = gimo_data_store_new ();
+    g_assert (!gimo_data_store_deserialize (copy, variant));
+    g_variant_unref (variant);
+    g_object_unref (copy);
+
+    /* Through a mapped file */
+    file_name = g_build_filename (g_get_tmp_dir (),
+                                  "test-datastore.bin",
+                                  NULL);
+    g_assert (gimo_data_store_save (store, file_name));
+    g_object_unref (store);
+
+    store = gimo_data_store_new ();
+    g_assert (gimo_data_store_read (store, file_name));
+    _test_data_store_check (store);
+    g_object_unref (store);
+
+    g_unlink (file_name);
+    g_free (file_name);
+}
+
+static void _test_data_store_table (void)
+{
+    GimoDataStore *store, *child;
+    GValue value = G_VALUE_INIT;
+    const GValue *v;
+    GObject *object;
+    gchar key[32];
+    gchar *str;
+    GQuark quark;
+    guint i;
+
+    store = gimo_data_store_new ();
+    g_value_init (&value, G_TYPE_INT);
+
+    for (i = 0; i < 1000; ++i) {
+        g_snprintf (key, sizeof (key), "counter%u", i);
+        g_value_set_int (&value, i);
+        gimo_data_store_set (store, key, &value);
+    }
+
+    /* Overwritten in place, then removed and added again. */
+    for (i = 0; i < 1000; ++i) {
+        g_snprintf (key, sizeof (key), "counter%u", i);
+        g_value_set_int (&value, i * 2);
+        gimo_data_store_set (store, key, &value);
+
+        if (i % 3 == 0)
+            gimo_data_store_set (store, key, NULL);
+    }
+
+    for (i = 0; i < 1000; i += 2) {
+        g_snprintf (key, sizeof (key), "counter%u", i);
+        g_value_set_int (&value, -1);
+        gimo_data_store_set (store, key, &value);
+    }
+
+    for (i = 0; i < 1000; ++i) {
+        g_snprintf (key, sizeof (key), "counter%u", i);
+        v = gimo_data_store_get (store, key);
+
+        if (i % 2 == 0)
+            g_assert (v && -1 == g_value_get_int (v));
+        else if (i % 3 == 0)
+            g_assert (!v);
+        else
+            g_assert (v && (gint) i * 2 == g_value_get_int (v));
+    }
+
+    g_value_unset (&value);
+
+    /* Other type for the same key */
+    gimo_data_store_set_string (store, "counter1", "one");
+    g_assert (strcmp (gimo_data_store_get_string (store, "counter1"),
+                      "one") == 0);
+
+    /* Copied from another entry of the store */
+    gimo_data_store_set (store, "copy", gimo_data_store_get (store, "counter1"));
+    g_assert (strcmp (gimo_data_store_get_string (store, "copy"),
+                      "one") == 0);
+
+    g_assert (!gimo_data_store_get (store, "never-interned-key"));
+
+    quark = g_quark_from_static_string ("quark");
+    g_assert (!gimo_data_store_get_quark (store, quark));
+    g_value_init (&value, G_TYPE_DOUBLE);
+    g_value_set_double (&value, 1.5);
+    gimo_data_store_set_quark (store, quark, &value);
+    g_value_unset (&value);
+    v = gimo_data_store_get (store, "quark");
+    g_assert (v && 1.5 == g_value_get_double (v));
+    g_assert (gimo_data_store_get_quark (store, quark) == v);
+    gimo_data_store_set_quark (store, quark, NULL);
+    g_assert (!gimo_data_store_get_quark (store, quark));
+
+    /* The copies outlive the values of the store. */
+    str = gimo_data_store_dup_string (store, "counter1");
+    gimo_data_store_set_string (store, "counter1", "two");
+    g_assert (str && strcmp (str, "one") == 0);
+    g_free (str);
+    g_assert (!gimo_data_store_dup_string (store, "counter5"));
+    g_assert (!gimo_data_store_dup_string (store, "never-interned-key"));
+
+    child = gimo_data_store_new ();
+    gimo_data_store_set_object (store, "child", G_OBJECT (child));
+    g_object_unref (child);
+    object = gimo_data_store_dup_object (store, "child");
+    gimo_data_store_set_object (store, "child", NULL);
+    g_assert (object == G_OBJECT (child) && GIMO_IS_DATASTORE (object));
+    g_object_unref (object);
+    g_assert (!gimo_data_store_dup_object (store, "counter1"));
+
+    g_object_unref (store);
+}
+
+static gpointer _test_data_store_thread (gpointer data)
+{
+    GimoDataStore *store = data;
+    GValue value = G_VALUE_INIT;
+    gint64 old;
+    guint i;
+
+    for (i = 0; i < 1000; ++i) {
+        gimo_data_store_increment (store, "counter", 1);
+
+        do {
+            g_assert (gimo_data_store_get_value (store, "cas", &value));
+            old = g_value_get_int (&value);
+            g_value_unset (&value);
+        } while (!gimo_data_store_compare_and_set_int64 (store, "cas",
+                                                         old, old + 2));
+    }
+
+    return NULL;
+}
+
+static void _test_data_store_atomic (void)
+{
+    GimoDataStore *store;
+    GValue value = G_VALUE_INIT;
+    GThread *threads[4];
+    guint i;
+
+    store = gimo_data_store_new ();
+
+    g_assert (5 == gimo_data_store_increment (store, "int64", 5));
+    g_assert (3 == gimo_data_store_increment (store, "int64", -2));
+    g_assert (gimo_data_store_get_value (store, "int64", &value));
+    g_assert (G_VALUE_TYPE (&value) == G_TYPE_INT64);
+    g_assert (3 == g_value_get_int64 (&value));
+    g_value_unset (&value);
+
+    g_assert (!gimo_data_store_compare_and_set_int64 (store, "int64", 4, 9));
+    g_assert (gimo_data_store_compare_and_set_int64 (store, "int64", 3, 9));
+    g_assert (10 == gimo_data_store_increment (store, "int64", 1));
+
+    g_assert (gimo_data_store_compare_and_set_int64 (store, "new", 0, 7));
+    g_assert (7 == g_value_get_int64 (gimo_data_store_get (store, "new")));
+
+    /* The integer type is kept. */
+    g_value_init (&value, G_TYPE_UINT);
+    g_value_set_uint (&value, 1);
+    gimo_data_store_set (store, "uint", &value);
+    g_value_unset (&value);
+    g_assert (2 == gimo_data_store_increment (store, "uint", 1));
+    g_assert (G_VALUE_TYPE (gimo_data_store_get (store, "uint")) ==
+              G_TYPE_UINT);
+
+    gimo_data_store_set_string (store, "string", "one");
+    g_assert (0 == gimo_data_store_increment (store, "string", 1));
+    g_assert (!gimo_data_store_compare_and_set_int64 (store, "string",
+                                                      0, 1));
+
+    g_assert (!gimo_data_store_get_value (store, "missing", &value));
+    g_assert (!G_IS_VALUE (&value));
+
+    g_value_init (&value, G_TYPE_INT);
+    g_value_set_int (&value, 0);
+    gimo_data_store_set (store, "cas", &value);
+    g_value_unset (&value);
+
+    for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+        threads[i] = g_thread_new ("datastore",
+                                   _test_data_store_thread,
+                                   store);
+
+    for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+        g_thread_join (threads[i]);
+
+    g_assert (4000 == gimo_data_store_increment (store, "counter", 0));
+    g_assert (8000 == g_value_get_int (gimo_data_store_get (store, "cas")));
+
+    g_object_unref (store);
+}
+
 int main (int argc, char *argv[])
 {
     GimoDataStore *store;
@@ -54,5 +324,9 @@ int main (int argc, char *argv[])
     g_object_unref (object);
     g_object_unref (store);
 
+    _test_data_store_serialize ();
+    _test_data_store_table ();
+    _test_data_store_atomic ();
+
     return 0;
 }
@@ -18,10 +18,89 @@
  * Boston, MA 02111-1307, USA.
  */
 #include "config.h"
+#include "gimo-builtin.h"
 #include "gimo-dlmodule.h"
 #include "gimo-factory.h"
 #include "gimo-loader.h"
 #include "gimo-plugin.h"
+#include <string.h>
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+static GObject* test_builtin_new (GObject *param)
+{
+    return g_object_new (G_TYPE_OBJECT, NULL);
+}
+
+GIMO_BUILTIN_BEGIN (test)
+    GIMO_BUILTIN_SYMBOL (test_builtin_new)
+GIMO_BUILTIN_END (test, "test-builtin")
+
+static void test_module_builtin (void)
+{
+    GimoModule *module;
+    GObject *object;
+
+    g_assert (gimo_builtin_exists ("test-builtin"));
+    g_assert (gimo_builtin_exists ("plugins/test-builtin.so"));
+    g_assert (!gimo_builtin_exists ("demo-plugin.so"));
+    g_assert (!gimo_builtin_exists ("test-builtin.py"));
+
+    module = GIMO_MODULE (gimo_builtin_new ());
+    g_assert (!gimo_module_open (module, "demo-plugin.so"));
+    g_assert (gimo_module_open (module, "plugins/test-builtin.so"));
+    g_assert (!strcmp (gimo_module_get_name (module), "test-builtin"));
+    object = gimo_module_resolve (module, "test_builtin_new", NULL);
+    g_assert (G_IS_OBJECT (object));
+    g_object_unref (object);
+    g_assert (!gimo_module_resolve (module, "not_exist", NULL));
+    g_assert (gimo_module_close (module));
+    g_object_unref (module);
+
+    /* A name which is not a file is passed to the module as is */
+    {
+        GimoLoader *loader;
+        GimoFactory *factory;
+
+        loader = gimo_loader_new_cached ();
+        factory = gimo_factory_new ((GimoFactoryFunc) gimo_builtin_new,
+                                    NULL);
+        g_assert (gimo_loader_register (loader, NULL, factory));
+        g_object_unref (factory);
+
+        module = GIMO_MODULE (gimo_loader_load (loader, "test-builtin"));
+        g_assert (GIMO_IS_BUILTIN (module));
+        g_assert (gimo_loader_load (loader, "test-builtin") ==
+                  GIMO_LOADABLE (module));
+        g_object_unref (module);
+        g_object_unref (module);
+        g_assert (!gimo_loader_load (loader, "not-exist"));
+        g_object_unref (loader);
+    }
+}
+
+static void _test_module_setup (GimoLoadable *object,
+                                gpointer user_data)
+{
+    gimo_dlmodule_set_flags (GIMO_DLMODULE (object),
+                             GIMO_MODULE_BIND_NOW |
+                             GIMO_MODULE_BIND_LOCAL);
+}
+
+static void _test_module_notify (GObject *object,
+                                 GParamSpec *pspec,
+                                 gpointer user_data)
+{
+    ++*(guint *) user_data;
+}
+
+static void _test_module_toggle (gpointer data,
+                                 GObject *object,
+                                 gboolean is_last_ref)
+{
+}
 
 static void test_module_common (gboolean cached)
 {
@@ -30,6 +109,8 @@ static void test_module_common (gboolean cached)
     GObject *plugin;
     GimoFactory *factory;
     GPtrArray *paths;
+    guint hits, misses, evictions;
+    gchar *dir_name, *file_name;
 
 #ifdef HAVE_INTROSPECTION
     GModule *gmodule;
@@ -48,6 +129,9 @@ static void test_module_common (gboolean cached)
     g_assert (paths && paths->len > 0);
     g_ptr_array_unref (paths);
 
+    g_assert (gimo_loader_prefetch (loader, "demo-plugin.so"));
+    g_assert (!gimo_loader_prefetch (loader, "not-exist.so"));
+
     /* Dynamic library */
     g_assert (!gimo_loader_load (loader, "demo-plugin.so"));
     factory = gimo_factory_new ((GimoFactoryFunc) gimo_dlmodule_new, NULL);
@@ -61,21 +145,128 @@ static void test_module_common (gboolean cached)
         g_assert (gimo_loader_load (loader, "demo-plugin.so") ==
                   GIMO_LOADABLE (module));
         g_object_unref (module);
+        gimo_loader_query_cache_stats (loader, &hits, &misses, &evictions);
+        g_assert (1 == hits && 1 == misses && 0 == evictions);
+
+        /* Different names of the same file share the cached object */
+        dir_name = g_path_get_dirname (gimo_module_get_name (module));
+        file_name = g_build_filename (dir_name, ".", "demo-plugin.so", NULL);
+        g_assert (gimo_loader_load (loader, file_name) ==
+                  GIMO_LOADABLE (module));
+        g_object_unref (module);
+        g_free (file_name);
+        g_free (dir_name);
     }
     else {
-        GimoLoadable *m2 = gimo_loader_load (loader, "demo-plugin.so");
+        GimoLoadable *m2 = gimo_loader_load_full (loader,
+                                                  "demo-plugin.so",
+                                                  _test_module_setup,
+                                                  NULL);
         g_assert (m2 != GIMO_LOADABLE (module));
+        g_assert (gimo_dlmodule_get_flags (GIMO_DLMODULE (m2)) ==
+                  (GIMO_MODULE_BIND_NOW | GIMO_MODULE_BIND_LOCAL));
         g_object_unref (m2);
     }
 
     g_assert (GIMO_IS_DLMODULE (module));
+    g_assert (gimo_dlmodule_get_open_time (GIMO_DLMODULE (module)) >= 0);
     plugin = gimo_module_resolve (module,
                                   "test_plugin_new",
                                   NULL);
     g_assert (GIMO_IS_PLUGIN (plugin));
+
+    /* The module can't be unloaded while its objects are alive */
+    g_assert (!gimo_module_close (module));
     g_object_unref (plugin);
+
+    /* demo-plugin registers a static type, it's made resident */
+    g_assert (!gimo_module_close (module));
+    g_assert (gimo_module_get_name (module));
+
+    /* Symbols served by the descriptor need no export */
+    {
+        const GimoModuleDescriptor *descriptor;
+
+        descriptor = gimo_dlmodule_get_descriptor (GIMO_DLMODULE (module));
+        g_assert (descriptor);
+        g_assert (GIMO_MODULE_DESCRIPTOR_VERSION == descriptor->version);
+        g_assert (!descriptor->start && !descriptor->stop);
+
+        plugin = gimo_module_resolve (module, "demo_plugin_object", NULL);
+        g_assert (GIMO_IS_PLUGIN (plugin));
+        g_object_unref (plugin);
+    }
+
+    {
+        const gchar *symbols[] = { "test_plugin_new", "not_exist", NULL };
+        GPtrArray *objects;
+
+        objects = gimo_module_resolve_many (module, symbols, NULL);
+        g_assert (objects && 2 == objects->len);
+        g_assert (GIMO_IS_PLUGIN (g_ptr_array_index (objects, 0)));
+        g_assert (!g_ptr_array_index (objects, 1));
+        g_ptr_array_unref (objects);
+        g_assert (!gimo_module_resolve (module, "not_exist", NULL));
+    }
     g_object_unref (module);
 
+    if (cached) {
+        guint notified = 0;
+
+        g_signal_connect (loader, "notify::capacity",
+                          G_CALLBACK (_test_module_notify), &notified);
+        gimo_loader_set_capacity (loader, 1);
+        gimo_loader_set_capacity (loader, 1);
+        g_assert (1 == gimo_loader_get_capacity (loader));
+        g_assert (1 == notified);
+        paths = gimo_loader_query_cached (loader);
+        g_assert (paths && 1 == paths->len);
+        g_ptr_array_unref (paths);
+        gimo_loader_set_capacity (loader, 0);
+        g_assert (2 == notified);
+        g_signal_handlers_disconnect_by_func (loader,
+                                              _test_module_notify,
+                                              &notified);
+    }
+
+    /* An object also held by a binding is kept until it's released */
+    if (cached) {
+        GimoLoadable *other;
+        guint before;
+
+        module = GIMO_MODULE (gimo_loader_load (loader, "demo-plugin.so"));
+        g_object_add_toggle_ref (G_OBJECT (module),
+                                 _test_module_toggle,
+                                 NULL);
+        g_object_unref (module);
+        other = gimo_loader_load (loader, "unload-plugin.so");
+        g_assert (other);
+        g_object_unref (other);
+
+        gimo_loader_query_cache_stats (loader, NULL, NULL, &before);
+        gimo_loader_set_capacity (loader, 1);
+        gimo_loader_query_cache_stats (loader, NULL, NULL, &evictions);
+        g_assert (before + 1 == evictions);
+        paths = gimo_loader_query_cached (loader);
+        g_assert (paths && 1 == paths->len);
+        g_assert (g_ptr_array_index (paths, 0) == module);
+        g_ptr_array_unref (paths);
+
+        g_object_remove_toggle_ref (G_OBJECT (module),
+                                    _test_module_toggle,
+                                    NULL);
+        other = gimo_loader_load (loader, "unload-plugin.so");
+        g_assert (other);
+        gimo_loader_query_cache_stats (loader, NULL, NULL, &evictions);
+        g_assert (before + 2 == evictions);
+        paths = gimo_loader_query_cached (loader);
+        g_assert (paths && 1 == paths->len);
+        g_assert (g_ptr_array_index (paths, 0) == other);
+        g_ptr_array_unref (paths);
+        g_object_unref (other);
+        gimo_loader_set_capacity (loader, 0);
+    }
+
 #ifdef HAVE_INTROSPECTION
     if (!cached) {
         gimo_loader_remove_paths (loader, TEST_PLUGIN_PATH);
@@ -129,17 +320,178 @@ static void test_module_common (gboolean cached)
     g_assert (GIMO_IS_PLUGIN (plugin));
     g_object_unref (plugin);
     g_object_unref (module);
+
+    /* Only the cache references the modules now */
+    gimo_loader_set_capacity (loader, 1);
+    gimo_loader_query_cache_stats (loader, NULL, NULL, &evictions);
+    g_assert (evictions > 0);
 #endif /* HAVE_INTROSPECTION */
 
     g_object_unref (loader);
 }
 
+static gpointer _test_module_load_thread (gpointer data)
+{
+    return gimo_loader_load (data, "demo-plugin.so");
+}
+
+static void _test_module_load_ready (GObject *source,
+                                     GAsyncResult *res,
+                                     gpointer user_data)
+{
+    gpointer *params = user_data;
+
+    params[1] = gimo_loader_load_finish (GIMO_LOADER (source), res);
+    g_main_loop_quit (params[0]);
+}
+
+static void test_module_concurrent (void)
+{
+    GimoLoader *loader;
+    GimoFactory *factory;
+    GThread *threads[8];
+    GimoLoadable *modules[G_N_ELEMENTS (threads)];
+    GPtrArray *cached;
+    GPtrArray *names, *results, *errors, *failed;
+    gpointer params[2];
+    guint i;
+
+    loader = gimo_loader_new_cached ();
+    gimo_loader_add_paths (loader, TEST_PLUGIN_PATH);
+    factory = gimo_factory_new ((GimoFactoryFunc) gimo_dlmodule_new, NULL);
+    g_assert (gimo_loader_register (loader, "so", factory));
+    g_object_unref (factory);
+
+    for (i = 0; i < G_N_ELEMENTS (threads); ++i) {
+        threads[i] = g_thread_new ("loader",
+                                   _test_module_load_thread,
+                                   loader);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+        modules[i] = g_thread_join (threads[i]);
+
+    for (i = 0; i < G_N_ELEMENTS (threads); ++i) {
+        g_assert (modules[i] && modules[i] == modules[0]);
+        g_object_unref (modules[i]);
+    }
+
+    cached = gimo_loader_query_cached (loader);
+    g_assert (cached && 1 == cached->len);
+    g_ptr_array_unref (cached);
+
+    /* Batch load */
+    names = g_ptr_array_new ();
+    g_ptr_array_add (names, "demo-plugin.so");
+    g_ptr_array_add (names, "not-exist.so");
+    g_ptr_array_add (names, "demo-plugin.so");
+    results = gimo_loader_load_many (loader, names, &errors);
+    g_assert (3 == results->len && 3 == errors->len);
+    g_assert (g_ptr_array_index (results, 0));
+    g_assert (g_ptr_array_index (results, 0) ==
+              g_ptr_array_index (results, 2));
+    g_assert (!g_ptr_array_index (results, 1));
+    g_assert (!g_ptr_array_index (errors, 0));
+    g_assert (strstr (g_ptr_array_index (errors, 1), "not-exist.so"));
+    g_ptr_array_unref (errors);
+    g_ptr_array_unref (names);
+
+    /* Concurrent failures each report their own file. */
+    names = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < 16; ++i)
+        g_ptr_array_add (names, g_strdup_printf ("not-exist-%u.so", i));
+
+    failed = gimo_loader_load_many (loader, names, &errors);
+    g_assert (names->len == errors->len);
+
+    for (i = 0; i < names->len; ++i) {
+        g_assert (!g_ptr_array_index (failed, i));
+        g_assert (strstr (g_ptr_array_index (errors, i),
+                          g_ptr_array_index (names, i)));
+    }
+
+    g_ptr_array_unref (failed);
+    g_ptr_array_unref (errors);
+    g_ptr_array_unref (names);
+
+    /* Asynchronous load */
+    params[0] = g_main_loop_new (NULL, FALSE);
+    params[1] = NULL;
+    gimo_loader_load_async (loader, "demo-plugin.so", NULL,
+                            _test_module_load_ready, params);
+    g_main_loop_run (params[0]);
+    g_main_loop_unref (params[0]);
+    g_assert (params[1] == g_ptr_array_index (results, 0));
+    g_object_unref (params[1]);
+    g_ptr_array_unref (results);
+
+    g_object_unref (loader);
+}
+
+#if defined (HAVE_DLFCN_H) && defined (RTLD_NOLOAD)
+static void test_module_unload (void)
+{
+    GimoLoader *loader;
+    GimoFactory *factory;
+    GimoModule *module;
+    GObject *object;
+    gchar *file_name;
+    void *handle;
+
+    loader = gimo_loader_new ();
+    gimo_loader_add_paths (loader, TEST_PLUGIN_PATH);
+    factory = gimo_factory_new ((GimoFactoryFunc) gimo_dlmodule_new, NULL);
+    g_assert (gimo_loader_register (loader, "so", factory));
+    g_object_unref (factory);
+
+    module = GIMO_MODULE (gimo_loader_load (loader, "unload-plugin.so"));
+    g_assert (module);
+    file_name = g_strdup (gimo_module_get_name (module));
+    handle = dlopen (file_name, RTLD_LAZY | RTLD_NOLOAD);
+    g_assert (handle);
+    dlclose (handle);
+
+    object = gimo_module_resolve (module, "unload_plugin_object", NULL);
+    g_assert (G_IS_OBJECT (object));
+    g_assert (!gimo_module_close (module));
+    g_object_unref (object);
+
+    /* The closed library is unmapped once its object is collected */
+    g_assert (gimo_module_get_name (module));
+    _gimo_dlmodule_collect ();
+    g_assert (!gimo_module_get_name (module));
+    g_assert (!dlopen (file_name, RTLD_LAZY | RTLD_NOLOAD));
+    g_assert (gimo_module_close (module));
+
+    /* Reopened, a close after the object is gone unmaps it at once */
+    g_assert (gimo_loadable_load (GIMO_LOADABLE (module), file_name));
+    object = gimo_module_resolve (module, "unload_plugin_object", NULL);
+    g_assert (G_IS_OBJECT (object));
+    g_object_unref (object);
+    g_assert (gimo_module_close (module));
+    g_assert (!dlopen (file_name, RTLD_LAZY | RTLD_NOLOAD));
+
+    /* The scheduled collect finds nothing left */
+    while (g_main_context_iteration (NULL, FALSE));
+
+    g_free (file_name);
+    g_object_unref (module);
+    g_object_unref (loader);
+}
+#endif
+
 int main (int argc, char *argv[])
 {
     g_type_init ();
 
     test_module_common (FALSE);
     test_module_common (TRUE);
+    test_module_concurrent ();
+    test_module_builtin ();
+
+#if defined (HAVE_DLFCN_H) && defined (RTLD_NOLOAD)
+    test_module_unload ();
+#endif
 
     return 0;
 }
@@ -0,0 +1,30 @@
+/* GIMO - A plugin framework based on GObject.
+ *
+ * Copyright (C) 2012 TinySoft, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include <glib-object.h>
+#include <gmodule.h>
+
+/*
+ * A module leaving nothing behind: it registers no type and connects
+ * no handler, so it's unloaded once its objects are gone.
+ */
+G_MODULE_EXPORT GObject* unload_plugin_object (GObject *param)
+{
+    return g_object_new (G_TYPE_OBJECT, NULL);
+}